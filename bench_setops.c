@@ -0,0 +1,131 @@
+//
+// Measures where galloping beats the linear (SIMD) set kernels, to pick gallop_ratio in setops.c.
+// usage: bench_setops [small_set_size ...]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include "setops.h"
+
+#define UNIVERSE 1000000
+#define SETS 64
+#define TARGET_ELEMENTS 20000000 // per measurement, summed over both sets
+
+int compareInts(const void *a, const void *b) {
+    int x = *(const int *) a;
+    int y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+// sorted set of n distinct ints. the sets of one benchmark overlap since they are drawn from a small range
+int *randomSet(int n, int range) {
+    int *set = malloc(sizeof(int) * n);
+    int m = 0;
+    while (m < n) {
+        int i;
+        for (i = m; i < n; i++)
+            set[i] = rand() % range;
+        qsort(set, n, sizeof(int), compareInts);
+        m = 1;
+        for (i = 1; i < n; i++)
+            if (set[i] != set[m - 1])
+                set[m++] = set[i];
+    }
+    return set;
+}
+
+double seconds() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+// ns per intersectCount + both differences of a small and a large set
+double measure(int **small, int **large, int ns, int nl, int *out, int ratio, int tiny) {
+    gallop_ratio = ratio;
+    gallop_tiny = tiny;
+    int reps = TARGET_ELEMENTS / (ns + nl) + 1;
+    long sum = 0;
+
+    double start = seconds();
+    int r;
+    for (r = 0; r < reps; r++) {
+        int i = r % SETS;
+        sum += intersectCount(small[i], ns, large[i], nl);
+        sum += difference(small[i], ns, large[i], nl, out);
+        sum += difference(large[i], nl, small[i], ns, out);
+    }
+    double elapsed = seconds() - start;
+
+    if (sum == 42) // keep the compiler from dropping the loop
+        puts("");
+
+    return elapsed * 1.0e9 / reps;
+}
+
+int main(int argc, char **argv) {
+    int sizes[] = {4, 16, 64, 256};
+    int nsizes = 4;
+    int *custom = NULL;
+
+    if (argc > 1) {
+        nsizes = argc - 1;
+        custom = malloc(sizeof(int) * nsizes);
+        int i;
+        for (i = 0; i < nsizes; i++)
+            custom[i] = atoi(argv[i + 1]);
+    }
+
+    int default_ratio = gallop_ratio;
+    int default_tiny = gallop_tiny;
+
+    printf("kernels: %s, current gallop_ratio: %d, gallop_tiny: %d\n", setopsKernels(), default_ratio, default_tiny);
+    puts("small   ratio   linear ns   gallop ns   adaptive ns");
+
+    int s;
+    for (s = 0; s < nsizes; s++) {
+        int ns = custom != NULL ? custom[s] : sizes[s];
+        int crossover = -1;
+        int ratio;
+
+        for (ratio = 1; ratio <= 1024; ratio *= 2) {
+            int nl = ns * ratio;
+            int range = nl * 4 < UNIVERSE ? nl * 4 : UNIVERSE;
+            int *small[SETS];
+            int *large[SETS];
+            int *out = malloc(sizeof(int) * (ns + nl));
+            int i;
+            for (i = 0; i < SETS; i++) {
+                small[i] = randomSet(ns, range);
+                large[i] = randomSet(nl, range);
+            }
+
+            double linear = measure(small, large, ns, nl, out, INT_MAX, 0);
+            double gallop = measure(small, large, ns, nl, out, 1, 0);
+            double adaptive = measure(small, large, ns, nl, out, default_ratio, default_tiny);
+            printf("%5d %7d %11.1f %11.1f %13.1f\n", ns, ratio, linear, gallop, adaptive);
+
+            // equal sizes never gallop, so start at 2. the crossover is where galloping starts winning for good
+            if (ratio > 1 && gallop < linear && crossover == -1)
+                crossover = ratio;
+            else if (gallop >= linear)
+                crossover = -1;
+
+            for (i = 0; i < SETS; i++) {
+                free(small[i]);
+                free(large[i]);
+            }
+            free(out);
+        }
+
+        if (crossover == -1)
+            printf("small size %d: galloping never won\n", ns);
+        else
+            printf("small size %d: galloping wins from ratio %d\n", ns, crossover);
+    }
+
+    free(custom);
+    return 0;
+}
@@ -0,0 +1,52 @@
+//
+// Converts preprocessed .metis graphs and .nl community files into their binary formats
+// (see graph.h and index.h), which mpicomm can mmap instead of parsing text on every rank.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "graph.h"
+#include "index.h"
+
+int endsWith(char *s, char *suffix) {
+    size_t n = strlen(s);
+    size_t m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        printf("usage: %s (metis_graph | communities.nl) out_file\n", argv[0]);
+        return 1;
+    }
+
+    if (endsWith(argv[1], ".nl")) {
+        if (index_write_binary(argv[1], argv[2])) {
+            printf("could not convert %s to %s\n", argv[1], argv[2]);
+            return 1;
+        }
+
+        printf("wrote %s\n", argv[2]);
+        return 0;
+    }
+
+    FILE *f = fopen(argv[1], "r");
+    if (f == NULL) {
+        printf("could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    graph *g = fromMetis(f);
+    fclose(f);
+
+    if (toBinary(g, argv[2])) {
+        printf("could not write %s\n", argv[2]);
+        return 1;
+    }
+
+    printf("wrote %s: %d nodes, %d edges\n", argv[2], g->n, g->e / 2);
+
+    freeGraph(g);
+    return 0;
+}
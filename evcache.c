@@ -0,0 +1,96 @@
+//
+// Eigenvalue cache, see evcache.h
+//
+
+#include <stdlib.h>
+#include "evcache.h"
+
+typedef struct {
+    unsigned long long key; // nodesHash of the node set, 0 for empty slots
+    int n;
+    int first; // smallest and largest node id, so a hash collision doesn't return another node set's ev
+    int last;
+    float ev;
+    unsigned int stored; // when the entry was stored, for replacement
+} ev_entry;
+
+static ev_entry *entries = NULL;
+static unsigned int nstored = 0;
+
+long ev_cache_hits = 0;
+
+// FNV-1a over the node ids, finished with the splitmix64 mixer so the low bits that pick the bucket are well spread
+unsigned long long nodesHash(const int *nodes, int n) {
+    unsigned long long h = 0xcbf29ce484222325ULL ^ (unsigned long long) n;
+    int i;
+    for (i = 0; i < n; i++) {
+        h ^= (unsigned int) nodes[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    return h != 0 ? h : 1; // 0 marks empty slots
+}
+
+static inline int matches(ev_entry *e, unsigned long long key, const int *nodes, int n) {
+    return e->key == key && e->n == n && (n == 0 || (e->first == nodes[0] && e->last == nodes[n - 1]));
+}
+
+static ev_entry *bucket(unsigned long long key) {
+    if (entries == NULL)
+        entries = calloc(EV_CACHE_SIZE, sizeof(ev_entry));
+    return entries + (key & (EV_CACHE_SIZE / EV_CACHE_WAYS - 1)) * EV_CACHE_WAYS;
+}
+
+// the threads checking a batch of pairs share the cache, see tryMergeRandomBatch
+int evCacheLookup(const int *nodes, int n, float *ev) {
+    unsigned long long key = nodesHash(nodes, n);
+    int found = 0;
+
+#pragma omp critical(ev_cache)
+    {
+        ev_entry *b = bucket(key);
+        int i;
+        for (i = 0; i < EV_CACHE_WAYS && !found; i++) {
+            if (matches(&b[i], key, nodes, n)) {
+                *ev = b[i].ev;
+                ev_cache_hits++;
+                found = 1;
+            }
+        }
+    }
+    return found;
+}
+
+void evCacheStore(const int *nodes, int n, float ev) {
+    unsigned long long key = nodesHash(nodes, n);
+
+#pragma omp critical(ev_cache)
+    {
+        ev_entry *b = bucket(key);
+
+        // overwrite the same key, else the oldest entry
+        ev_entry *slot = &b[0];
+        int i;
+        for (i = 0; i < EV_CACHE_WAYS; i++) {
+            if (matches(&b[i], key, nodes, n)) {
+                slot = &b[i];
+                break;
+            }
+            if (b[i].stored < slot->stored)
+                slot = &b[i];
+        }
+
+        slot->key = key;
+        slot->n = n;
+        slot->first = n > 0 ? nodes[0] : 0;
+        slot->last = n > 0 ? nodes[n - 1] : 0;
+        slot->ev = ev;
+        slot->stored = ++nstored;
+    }
+}
@@ -0,0 +1,27 @@
+//
+// Bounded cache of community eigenvalues keyed by a hash of the node set.
+//
+
+#ifndef MPICOMM_EVCACHE_H
+#define MPICOMM_EVCACHE_H
+
+// number of cached eigenvalues, a power of two. Entries are grouped into buckets of EV_CACHE_WAYS, and a full
+// bucket replaces its least recently stored entry
+#define EV_CACHE_SIZE (1 << 16)
+#define EV_CACHE_WAYS 4
+
+// Each rank keeps every eigenvalue it computes, plus the eigenvalues of all merges it is told about in update
+// messages. Candidate unions that get rejected are often sampled again, and merged communities arrive with their
+// eigenvalue already known, so communityEv only runs the solver for node sets no rank has seen yet
+unsigned long long nodesHash(const int *nodes, int n);
+
+// returns 1 and sets ev if the node set is cached. Entries are matched on the hash, the size and the first and last
+// node id, so a collision would also need node sets of the same size and range
+int evCacheLookup(const int *nodes, int n, float *ev);
+
+void evCacheStore(const int *nodes, int n, float ev);
+
+// lookups answered from the cache so far
+extern long ev_cache_hits;
+
+#endif //MPICOMM_EVCACHE_H
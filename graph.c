@@ -4,10 +4,23 @@
 
 #include "graph.h"
 #include "lib.h"
+#include "setops.h"
+#include "nodeset.h"
+#include "spectral.h"
+#include "smallev.h"
+#include "evcache.h"
 #include <stdio.h>
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // just for debugging
 void communityIsMessedUp(community *a) {
@@ -27,82 +40,429 @@ void communityIsMessedUp(community *a) {
 #endif
 }
 
-// malloc n, 2e
-// read edges sequentially into edgelist
-// keep count of current index
-// put current index in nodemap on newline
-// unless currently on last node
-// assumes edges are sorted on a per-node basis
-graph *fromMetis(FILE *f) {
-    graph *g = malloc(sizeof(graph));
+#define METIS_READ_BLOCK (64 * 1024 * 1024)
+#define METIS_CHUNKS_PER_THREAD 4
+
+// read the rest of f into one buffer in large blocks. the buffer always ends with '\n' and a terminating 0
+static char *readAll(FILE *f, size_t *length) {
+    size_t capacity = METIS_READ_BLOCK;
+    size_t len = 0;
+    char *buf = malloc(capacity + 2);
+
+    size_t got;
+    while ((got = fread(buf + len, 1, capacity - len, f)) > 0) {
+        len += got;
+        if (len == capacity) {
+            capacity *= 2;
+            buf = realloc(buf, capacity + 2);
+        }
+    }
 
-    fscanf(f, "%d", &g->n);
-    fscanf(f, "%d", &g->e);
+    if (len == 0 || buf[len - 1] != '\n')
+        buf[len++] = '\n';
+    buf[len] = 0;
 
+    *length = len;
+    return buf;
+}
+
+// parse a non-negative decimal int starting at *p, moving *p past it
+static inline int parseInt(char **p) {
+    char *s = *p;
+    int x = 0;
+    while (*s >= '0' && *s <= '9')
+        x = x * 10 + (*s++ - '0');
+    *p = s;
+    return x;
+}
+
+static inline int isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// first byte after the next newline at or after p, or end
+static char *nextLine(char *p, char *end) {
+    char *nl = memchr(p, '\n', end - p);
+    return nl == NULL ? end : nl + 1;
+}
+
+// Parses the whole file in parallel:
+// 1. read everything into one buffer
+// 2. cut the body into chunks at line boundaries, one line belongs to one node
+// 3. count lines and numbers per chunk, prefix sums give each chunk's first node and first edge
+// 4. parse each chunk into its own slice of nodemap and edgelist, checking that lines are sorted
+// Without OpenMP, the same code runs on a single thread.
+graph *fromMetis(FILE *f) {
+    graph *g = malloc(sizeof(graph));
+    g->mapping = NULL;
+    g->mapping_size = 0;
+    g->cedges = NULL;
+    g->coffsets = NULL;
+    g->rows = NULL;
+    g->fetch = NULL;
+    g->part = NULL;
+
+    size_t length;
+    char *buf = readAll(f, &length);
+    char *end = buf + length;
+
+    // header
+    char *p = buf;
+    while (*p == ' ')
+        p++;
+    g->n = parseInt(&p);
+    while (*p == ' ')
+        p++;
+    g->e = parseInt(&p);
     g->e *= 2;
 
+    char *body = nextLine(p, end);
+
     g->nodemap = malloc(sizeof(int) * (g->n + 1)); // allocate extra slot for the end of the last node's edgelist
     g->edgelist = malloc(sizeof(int) * g->e);      // this simplifies iterating
 
-    int ch;
-    int current_node = -1; // begin with node id -1: we will be reading the header's newline and adding 1 as a consequence
-    int current_edge = 0;
-    int prev_edge = -1; // previous edge for keeping track of whether file is sorted
-
-    while ((ch = fgetc(f)) != EOF) {
-        if (ch == (int) '\n') {
-            current_node++;
-            prev_edge = -1;
+    int nthreads = 1;
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    int nchunks = nthreads * METIS_CHUNKS_PER_THREAD;
 
-            // break if all nodes have been read
-            if (current_node >= g->n)
-                break;
+    // chunk i covers [chunk_start[i], chunk_start[i + 1]), every chunk starts at the beginning of a line
+    char **chunk_start = malloc(sizeof(char *) * (nchunks + 1));
+    size_t *chunk_nodes = calloc(nchunks + 1, sizeof(size_t));
+    size_t *chunk_edges = calloc(nchunks + 1, sizeof(size_t));
 
-            g->nodemap[current_node] = current_edge;
+    int i;
+    chunk_start[0] = body;
+    for (i = 1; i < nchunks; i++) {
+        char *guess = body + (end - body) / nchunks * i;
+        chunk_start[i] = guess <= chunk_start[i - 1] ? chunk_start[i - 1] : nextLine(guess - 1, end);
+    }
+    chunk_start[nchunks] = end;
+
+    // count lines and numbers per chunk
+#pragma omp parallel for schedule(dynamic, 1)
+    for (i = 0; i < nchunks; i++) {
+        size_t nodes = 0;
+        size_t edges = 0;
+        char *q;
+        for (q = chunk_start[i]; q < chunk_start[i + 1]; q++) {
+            if (*q == '\n')
+                nodes++;
+            else if (isDigit(*q) && !isDigit(q[-1]))
+                edges++;
         }
+        chunk_nodes[i + 1] = nodes;
+        chunk_edges[i + 1] = edges;
+    }
+
+    // exclusive prefix sums, chunk_nodes[i] is now chunk i's first node id (same for edges)
+    for (i = 0; i < nchunks; i++) {
+        chunk_nodes[i + 1] += chunk_nodes[i];
+        chunk_edges[i + 1] += chunk_edges[i];
+    }
 
-        if (fscanf(f, "%d", &g->edgelist[current_edge])) {
-            g->edgelist[current_edge]--; // metis files are 1-indexed
-            current_edge++;
+    if (chunk_nodes[nchunks] != (size_t) g->n || chunk_edges[nchunks] != (size_t) g->e) {
+        printf("metis header says %d nodes and %d edges, but found %zu nodes and %zu edges. exiting...\n",
+               g->n, g->e / 2, chunk_nodes[nchunks], chunk_edges[nchunks] / 2);
+        exit(1);
+    }
+
+    int unsorted_node = -1;
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (i = 0; i < nchunks; i++) {
+        int current_node = chunk_nodes[i];
+        int current_edge = chunk_edges[i];
+        int prev_edge = -1; // previous edge for keeping track of whether file is sorted
+        char *q = chunk_start[i];
+        char *chunk_end = chunk_start[i + 1];
+
+        if (q < chunk_end)
+            g->nodemap[current_node] = current_edge;
 
-            if (g->edgelist[current_edge] < prev_edge) {
-                printf("metis graph is not sorted. exiting...\n");
-                exit(1);
-            } else {
-                prev_edge = g->edgelist[current_edge];
+        while (q < chunk_end) {
+            if (isDigit(*q)) {
+                int edge = parseInt(&q) - 1; // metis files are 1-indexed
+                g->edgelist[current_edge++] = edge;
+
+                if (edge < prev_edge) {
+#pragma omp critical
+                    if (unsorted_node == -1 || current_node < unsorted_node)
+                        unsorted_node = current_node;
+                }
+                prev_edge = edge;
+
+            } else if (*q++ == '\n') {
+                current_node++;
+                prev_edge = -1;
+                if (current_node < g->n)
+                    g->nodemap[current_node] = current_edge;
             }
         }
     }
 
+    if (unsorted_node != -1) {
+        printf("metis graph is not sorted (node %d). exiting...\n", unsorted_node + 1);
+        exit(1);
+    }
+
     g->nodemap[g->n] = g->e;
 
+    free(chunk_start);
+    free(chunk_nodes);
+    free(chunk_edges);
+    free(buf);
+
     return g;
 }
 
-// true iff edgelist[nodemap[u] : nodemap[u + 1]] has v
-int hasEdge(graph *g, int u, int v) {
-    int start = g->nodemap[u];
-    int end = g->nodemap[u + 1];
+// mmap a binary CSR file read-only and point nodemap/edgelist straight into the mapping.
+// no parsing or copying happens here, pages get faulted in on first access and are shared
+// through the page cache between all processes on the host that map the same file
+graph *fromBinary(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        printf("could not open %s. exiting...\n", filename);
+        exit(1);
+    }
 
-    int i;
-    for (i = start; i < end; i++) {
-        if (g->edgelist[i] == v)
-            return 1; /* Locals */
+    struct stat st;
+    fstat(fd, &st);
+
+    if ((size_t) st.st_size < sizeof(csr_header)) {
+        printf("%s is too small to be a binary graph. exiting...\n", filename);
+        exit(1);
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid after closing
+
+    if (mapping == MAP_FAILED) {
+        printf("could not mmap %s. exiting...\n", filename);
+        exit(1);
+    }
+
+    csr_header *header = mapping;
+    if (header->magic != CSR_MAGIC || header->version != CSR_VERSION) {
+        printf("%s is not a binary graph (version %d). exiting...\n", filename, CSR_VERSION);
+        exit(1);
+    }
+
+    size_t expected_size = sizeof(csr_header) + sizeof(int) * ((size_t) header->n + 1 + header->e);
+    if ((size_t) st.st_size != expected_size) {
+        printf("%s is truncated or corrupt: expected %zu bytes, got %zu. exiting...\n", filename, expected_size, (size_t) st.st_size);
+        exit(1);
+    }
+
+    graph *g = malloc(sizeof(graph));
+    g->n = header->n;
+    g->e = header->e;
+    g->nodemap = (int *) (header + 1);
+    g->edgelist = g->nodemap + g->n + 1;
+    g->mapping = mapping;
+    g->mapping_size = st.st_size;
+    g->cedges = NULL;
+    g->coffsets = NULL;
+    g->rows = NULL;
+    g->fetch = NULL;
+    g->part = NULL;
+
+    return g;
+}
+
+// write g in the binary CSR format read by fromBinary. returns 0 on success
+int toBinary(graph *g, char *filename) {
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL)
+        return 1;
+
+    csr_header header;
+    header.magic = CSR_MAGIC;
+    header.version = CSR_VERSION;
+    header.n = g->n;
+    header.e = g->e;
+
+    int ok = fwrite(&header, sizeof(csr_header), 1, f) == 1
+             && fwrite(g->nodemap, sizeof(int), g->n + 1, f) == (size_t) g->n + 1
+             && fwrite(g->edgelist, sizeof(int), g->e, f) == (size_t) g->e;
+
+    return fclose(f) != 0 || !ok;
+}
+
+// load a graph from either a binary CSR file or a preprocessed metis file, depending on the file's first bytes
+graph *loadGraph(char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        printf("could not open %s. exiting...\n", filename);
+        exit(1);
+    }
+
+    int magic = 0;
+    int is_binary = fread(&magic, sizeof(int), 1, f) == 1 && magic == CSR_MAGIC;
+
+    if (is_binary) {
+        fclose(f);
+        return fromBinary(filename);
+    }
+
+    rewind(f);
+    graph *g = fromMetis(f);
+    fclose(f);
+    return g;
+}
+
+void freeGraph(graph *g) {
+    if (g->mapping != NULL) {
+        munmap(g->mapping, g->mapping_size);
+    } else {
+        free(g->nodemap);
+        free(g->edgelist);
+    }
+    free(g->cedges);
+    free(g->coffsets);
+    free(g);
+}
+
+static int varintSize(unsigned int x) {
+    int size = 1;
+    while (x >= 0x80) {
+        x >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static unsigned char *writeVarint(unsigned char *p, unsigned int x) {
+    while (x >= 0x80) {
+        *p++ = (x & 0x7f) | 0x80;
+        x >>= 7;
+    }
+    *p++ = x;
+    return p;
+}
+
+// Replace nodemap/edgelist by the compressed representation (see graph.h). sorted social network
+// adjacencies have small gaps, so most neighbors take one or two bytes instead of four
+void compressGraph(graph *g) {
+    if (g->cedges != NULL || g->rows != NULL)
+        return;
+
+    size_t *offsets = malloc(sizeof(size_t) * (g->n + 1));
+    offsets[0] = 0;
+
+    int u;
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (u = 0; u < g->n; u++) {
+        size_t size = varintSize(g->nodemap[u + 1] - g->nodemap[u]);
+        int prev = 0;
+        int j;
+        for (j = g->nodemap[u]; j < g->nodemap[u + 1]; j++) {
+            size += varintSize(g->edgelist[j] - prev);
+            prev = g->edgelist[j];
+        }
+        offsets[u + 1] = size;
+    }
+
+    for (u = 0; u < g->n; u++)
+        offsets[u + 1] += offsets[u];
+
+    unsigned char *bytes = malloc(offsets[g->n] > 0 ? offsets[g->n] : 1);
+
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (u = 0; u < g->n; u++) {
+        unsigned char *p = writeVarint(bytes + offsets[u], g->nodemap[u + 1] - g->nodemap[u]);
+        int prev = 0;
+        int j;
+        for (j = g->nodemap[u]; j < g->nodemap[u + 1]; j++) {
+            p = writeVarint(p, g->edgelist[j] - prev);
+            prev = g->edgelist[j];
+        }
+    }
+
+    if (g->mapping != NULL) {
+        munmap(g->mapping, g->mapping_size);
+        g->mapping = NULL;
+        g->mapping_size = 0;
+    } else {
+        free(g->nodemap);
+        free(g->edgelist);
+    }
+
+    g->nodemap = NULL;
+    g->edgelist = NULL;
+    g->cedges = bytes;
+    g->coffsets = offsets;
+}
+
+int nodeDegree(graph *g, int u) {
+    neighbor_iter it;
+    neighbors(g, u, &it);
+    return it.remaining;
+}
+
+// true iff u's neighbors contain v
+int hasEdge(graph *g, int u, int v) {
+    neighbor_iter it;
+    int w;
+
+    neighbors(g, u, &it);
+    while (nextNeighbor(&it, &w)) {
+        if (w == v)
+            return 1;
+        if (w > v) // neighbors are sorted
+            return 0;
     }
 
     return 0;
 }
 
 float communityEv(community *c, graph *g) {
-    if (c->ev == 0) { // if ev hasn't been calculated before
-        matrix *sub = subgraph(g, c);
-        c->ev = laplacianEv(sub);
-        free(sub->rowmaj);
-        free(sub);
+    return mergedCommunityEv(c, NULL, NULL, g);
+}
+
+// the worker thread's buffers for the dense eigen path, see communityEv
+static ev_workspace *dense_workspace = NULL;
+#pragma omp threadprivate(dense_workspace)
+
+// 1 if c's ev is known without computing it, because it was computed before here or elsewhere
+int knownEv(community *c) {
+    return !isnan(c->ev) || evCacheLookup(c->nodes, c->n, &c->ev);
+}
+
+// Lambda 2 of c = a union b to within abstol, stored in c->ev and the cache
+static float solveEv(community *c, community *a, community *b, graph *g, double abstol) {
+    if (c->n >= SPARSE_EV_MIN_SIZE) { // dense matrices get too large, see spectral.h
+        c->ev = sparseCommunityEv(g, c, a, b, abstol);
+    } else if (SMALL_EV && c->n <= SMALL_EV_MAX_SIZE) {
+        c->ev = smallCommunityEv(g, c, abstol);
+    } else {
+        // c->n < SPARSE_EV_MIN_SIZE, so c fits the workspace
+        if (dense_workspace == NULL)
+            dense_workspace = evWorkspaceNew(SPARSE_EV_MIN_SIZE);
+
+        matrix laplacian = {c->n, dense_workspace->laplacian};
+        laplacianInto(g, c, &laplacian, dense_workspace->row_sums);
+        c->ev = laplacianEvWork(&laplacian, dense_workspace->row_sums, dense_workspace, abstol);
     }
+
+    evCacheStore(c->nodes, c->n, c->ev);
     return c->ev;
 }
 
+// communityEv of merged = a union b. Lanczos starts from the Fiedler vectors of a and b if they have them
+float mergedCommunityEv(community *merged, community *a, community *b, graph *g) {
+    if (knownEv(merged))
+        return merged->ev;
+    return solveEv(merged, a, b, g, ev_tolerance);
+}
+
+float exactCommunityEv(community *merged, community *a, community *b, graph *g) {
+    if (merged->fiedler != NULL) // the coarse solve's vector is closer than the parents'
+        return solveEv(merged, merged, NULL, g, 0);
+    return solveEv(merged, a, b, g, 0);
+}
+
 // Use LAPACK
 float laplacianEv(matrix *adj) {
     matrix *laplacian = toLaplacian(adj);
@@ -119,66 +479,153 @@ float laplacianEv(matrix *adj) {
 matrix *subgraph(graph *g, community *c) {
     matrix *adj = malloc(sizeof(matrix));
     adj->n = c->n;
-    adj->rowmaj = calloc(adj->n * adj->n, sizeof(float));
+    adj->rowmaj = malloc(adj->n * adj->n * sizeof(ev_real));
+    subgraphInto(g, c, adj);
+    return adj;
+}
+
+// subgraph into the c->n x c->n matrix adj
+void subgraphInto(graph *g, community *c, matrix *adj) {
+    memset(adj->rowmaj, 0, (size_t) c->n * c->n * sizeof(ev_real));
 
     int i;
     for (i = 0; i < c->n; i++) { // for each node i in c
         int k = 0;
-        int j = g->nodemap[c->nodes[i]];
+        int graph_edge;
+        neighbor_iter it;
+        neighbors(g, c->nodes[i], &it);
+        int has_edge = nextNeighbor(&it, &graph_edge);
 
         // while not running out of bounds in c's nodes or node i's edges:
-        while (k < c->n && j < g->nodemap[c->nodes[i] + 1]) {
+        while (k < c->n && has_edge) {
             int community_node = c->nodes[k];
-            int graph_edge = g->edgelist[j];
 
             if (community_node < graph_edge)
                 k++;
             else if (graph_edge < community_node)
-                j++;
+                has_edge = nextNeighbor(&it, &graph_edge);
             else { // graph_edge == community_node
                 adj->rowmaj[i * c->n + k] = 1;
                 k++;
-                j++;
+                has_edge = nextNeighbor(&it, &graph_edge);
             }
         }
     }
+}
 
-    return adj;
+// the worker thread's map from graph node ids to indices in the community being assembled, -1 for other nodes
+static int *local_index = NULL;
+static int local_index_size = 0;
+#pragma omp threadprivate(local_index, local_index_size)
+
+int *localIndex(graph *g, community *c) {
+    int i;
+    if (local_index_size < g->n) {
+        free(local_index);
+        local_index = malloc(g->n * sizeof(int));
+        local_index_size = g->n;
+        for (i = 0; i < g->n; i++)
+            local_index[i] = -1;
+    }
+    for (i = 0; i < c->n; i++)
+        local_index[c->nodes[i]] = i;
+    return local_index;
+}
+
+void releaseLocalIndex(community *c) {
+    int i;
+    for (i = 0; i < c->n; i++)
+        local_index[c->nodes[i]] = -1;
+}
+
+void laplacianInto(graph *g, community *c, matrix *laplacian, ev_real *degrees) {
+    int n = c->n;
+    int i;
+    localIndex(g, c);
+
+    // the degrees within c, then 1 / sqrt of them for the entries
+    ev_real *inv_sqrt = laplacian->rowmaj; // borrows row 0, which is the last to be filled
+    for (i = 0; i < n; i++) {
+        int v;
+        int degree = 0;
+        neighbor_iter it;
+        neighbors(g, c->nodes[i], &it);
+        while (nextNeighbor(&it, &v))
+            degree += local_index[v] >= 0;
+        degrees[i] = degree;
+    }
+    memset(laplacian->rowmaj, 0, (size_t) n * n * sizeof(ev_real));
+    for (i = 0; i < n; i++)
+        inv_sqrt[i] = degrees[i] > 0 ? 1 / sqrt(degrees[i]) : 0;
+
+    // scatter the edges into the lower triangle, rows from the bottom so row 0's inv_sqrt stays intact until the end
+    for (i = n - 1; i >= 0; i--) {
+        ev_real *row = laplacian->rowmaj + (size_t) i * n;
+        ev_real scale = inv_sqrt[i];
+        int v;
+        neighbor_iter it;
+        neighbors(g, c->nodes[i], &it);
+        while (nextNeighbor(&it, &v)) {
+            int j = local_index[v];
+            if (j >= 0 && j < i)
+                row[j] = -scale * inv_sqrt[j];
+        }
+        row[i] = degrees[i] > 0 ? 1 : 0;
+    }
+    for (i = 1; i < n; i++)
+        inv_sqrt[i] = 0;
+
+    releaseLocalIndex(c);
 }
 
 // create a new community c that is the union of a and b
 // Kinda useless method that can be factored out
 community *merge(community *a, community *b) {
     community *c = setUnion(a, b);
-    c->ev = 0;
+    c->ev = EV_UNKNOWN;
     c->id = a->id;
     return c;
 }
 
 // Counts edges going from a to b
 int edgesBetweenSubsets(graph *g, community *a, community *b) {
+    // for large b, look every neighbor up in b's nodeset instead of walking all of b once per node of a
+    if (b->n >= NODESET_MIN_SIZE) {
+        nodeset *set = communitySet(b);
+        int count = 0;
+        int i;
+        for (i = 0; i < a->n; i++) {
+            int v;
+            neighbor_iter it;
+            neighbors(g, a->nodes[i], &it);
+            while (nextNeighbor(&it, &v))
+                count += nodesetContains(set, v);
+        }
+        return count;
+    }
+
     int count = 0; // number of edges
     int i = 0; // index in a
-    int j = 0; // index in current node's neighbors
     int k = 0; // index in b
 
     for (i = 0; i < a->n; i++) {
-        int start = g->nodemap[a->nodes[i]];
-        int end = g->nodemap[a->nodes[i] + 1];
-        j = start;
+        int a_node; // current neighbor of a->nodes[i]
+        neighbor_iter it;
+        neighbors(g, a->nodes[i], &it);
+        int has_neighbor = nextNeighbor(&it, &a_node);
         k = 0;
 
-        while (j < end || k < b->n) {
-            int a_node = j == end ? INT_MAX : g->edgelist[j];
-            int b_node = k == b->n ? INT_MAX : b->nodes[k];
+        // once either side runs out there can't be any more matches
+        while (has_neighbor && k < b->n) {
+            int b_node = b->nodes[k];
 
             if (a_node < b_node) {
-                j++;
+                has_neighbor = nextNeighbor(&it, &a_node);
             } else if (b_node < a_node) {
                 k++;
             } else { // b_node == a_node
                 count++;
-                j++;
+                has_neighbor = nextNeighbor(&it, &a_node);
                 k++;
             }
         }
@@ -187,9 +634,77 @@ int edgesBetweenSubsets(graph *g, community *a, community *b) {
     return count;
 }
 
+edge_counter *edgeCounterNew(graph *g) {
+    edge_counter *ec = malloc(sizeof(edge_counter));
+    ec->n = g->n;
+    ec->stamp = calloc(g->n > 0 ? g->n : 1, sizeof(unsigned int));
+    ec->epoch = 1;
+    return ec;
+}
+
+void edgeCounterFree(edge_counter *ec) {
+    if (ec == NULL)
+        return;
+    free(ec->stamp);
+    free(ec);
+}
+
+// One sweep over the neighbors of a and c, the disjoint parts of merged. out->disjoint and out->inner are
+//   edgesBetweenSubsets(g, a, c) and edgesBetweenSubsets(g, larger, larger) / 2
+// but in O(sum of their degrees) instead of walking the other set once per node. The rest is for
+// mergedEvUpperBound
+void countPairEdges(graph *g, edge_counter *ec, community *a, community *c, community *merged, pair_edges *out) {
+    if (ec->epoch > UINT_MAX - 3) {
+        memset(ec->stamp, 0, ec->n * sizeof(unsigned int));
+        ec->epoch = 1;
+    }
+    unsigned int in_overlap = ec->epoch;
+    unsigned int in_a = ec->epoch + 1;
+    unsigned int in_c = ec->epoch + 2;
+    ec->epoch += 3;
+
+    // the overlap is what's left of merged once a and c are stamped over it
+    int i;
+    for (i = 0; i < merged->n; i++)
+        ec->stamp[merged->nodes[i]] = in_overlap;
+    for (i = 0; i < a->n; i++)
+        ec->stamp[a->nodes[i]] = in_a;
+    for (i = 0; i < c->n; i++)
+        ec->stamp[c->nodes[i]] = in_c;
+
+    int counts[2][3] = {{0}}; // counts[a or c][overlap, a or c]: edges from the part to the others
+    int isolated = 0;
+    community *parts[2] = {a, c};
+    int p;
+    for (p = 0; p < 2; p++) {
+        for (i = 0; i < parts[p]->n; i++) {
+            int v;
+            int degree = 0;
+            neighbor_iter it;
+            neighbors(g, parts[p]->nodes[i], &it);
+            while (nextNeighbor(&it, &v)) {
+                unsigned int s = ec->stamp[v] - in_overlap;
+                if (s < 3) {
+                    counts[p][s]++;
+                    degree++;
+                }
+            }
+            isolated += degree == 0;
+        }
+    }
+
+    out->disjoint = counts[0][2];
+    out->inner = (a->n > c->n ? counts[0][1] : counts[1][2]) / 2; // every inner edge was seen from both ends
+    out->a_overlap = counts[0][0];
+    out->c_overlap = counts[1][0];
+    out->a_volume = (long) counts[0][0] + counts[0][1] + counts[0][2];
+    out->c_volume = (long) counts[1][0] + counts[1][1] + counts[1][2];
+    out->isolated = isolated;
+}
+
 void printCommunity(community *c) {
     printf("community %d: %d nodes", c->id, c->n);
-    if (c->ev != 0)
+    if (!isnan(c->ev))
         printf(", ev = %f", c->ev);
     printf(": ");
 
@@ -204,6 +719,23 @@ void printGraph(graph *g) {
     printf("graph: %d nodes, %d edges\n", g->n, g->e);
 
     int i;
+    if (g->edgelist == NULL) {
+        if (g->cedges != NULL)
+            printf("compressed to %zu bytes\n", g->coffsets[g->n]);
+        printf("neighbors: ");
+        int printed = 0;
+        for (i = 0; i < g->n && printed < 1000; i++) {
+            neighbor_iter it;
+            int v;
+            neighbors(g, i, &it);
+            while (nextNeighbor(&it, &v) && printed++ < 1000)
+                printf("%d ", v);
+            printf("| ");
+        }
+        puts("");
+        return;
+    }
+
     printf("nodemap: ");
     for (i = 0; i < g->n && i < 1000; i++)
         printf("%d ", g->nodemap[i]);
@@ -225,90 +757,60 @@ community *setUnion(community *a, community *b) {
         puts("COMMUNITY B IS NULL");
 
     community *c = malloc(sizeof(community));
-    c->nodes = calloc((a->n + b->n), sizeof(int));
-    c->ev = 0;
-    c->sibling = NULL;
+    c->nodes = malloc((a->n + b->n) * sizeof(int));
+    c->ev = EV_UNKNOWN;
+    c->set = NULL;
+    c->fiedler = NULL;
 
-    int i = 0; // index in c
-    int j = 0; // index in a
-    int k = 0; // index in b
-
-    while (j < a->n || k < b->n) {
-        int a_node = j == a->n ? INT_MAX : a->nodes[j];
-        int b_node = k == b->n ? INT_MAX : b->nodes[k];
-
-        if (a_node < b_node) {
-            c->nodes[i] = a->nodes[j];
-            j++;
-        } else if (b_node < a_node) {
-            c->nodes[i] = b->nodes[k];
-            k++;
-        } else { // b_node == a_node
-            c->nodes[i] = a->nodes[j];
-            j++;
-            k++;
-        }
-        i++;
-    }
-    c->n = i;
+    // the pair checks leave nodesets on the large communities they looked at, reuse them but don't build any here
+    if (a->set != NULL && b->set != NULL)
+        c->n = nodesetUnion(a->set, b->set, c->nodes);
+    else
+        c->n = setUnionInto(a->nodes, a->n, b->nodes, b->n, c->nodes);
 
     return c;
 }
 
-// copy+paste adaptation of setUnion
 // computes a-b
 community *setMinus(community *a, community *b) {
     community *c = malloc(sizeof(community));
-    c->nodes = calloc(a->n, sizeof(int));
-    c->ev = 0;
-    c->sibling = NULL;
+    c->nodes = malloc((a->n > 0 ? a->n : 1) * sizeof(int));
+    c->ev = EV_UNKNOWN;
+    c->set = NULL;
+    c->fiedler = NULL;
 
-    int i = 0; // index in c
-    int j = 0; // index in a
-    int k = 0; // index in b
-
-    while (j < a->n) {
-        int a_node = j == a->n ? INT_MAX : a->nodes[j];
-        int b_node = k == b->n ? INT_MAX : b->nodes[k];
-
-        if (a_node < b_node) {
-            c->nodes[i] = a->nodes[j];
-            i++;
-            j++;
-        } else if (b_node < a_node) {
-            k++;
-        } else { // b_node == a_node
-            j++;
-            k++;
-        }
-    }
-    c->n = i;
+    if (a->set != NULL && b->set != NULL)
+        c->n = nodesetDifference(a->set, b->set, c->nodes);
+    else
+        c->n = difference(a->nodes, a->n, b->nodes, b->n, c->nodes);
 
     return c;
 }
 
-// copy+paste adaptation of setUnion
-// computes |a intersect b|
+// computes |a intersect b|. A community is checked against many others while it's live, so large ones get a nodeset
 int commonElements(community *a, community *b) {
-    int i = 0; // number of common elements
-    int j = 0; // index in a
-    int k = 0; // index in b
+    if (a->n >= NODESET_MIN_SIZE && b->n >= NODESET_MIN_SIZE)
+        return nodesetIntersectCount(communitySet(a), communitySet(b));
+    return intersectCount(a->nodes, a->n, b->nodes, b->n);
+}
 
-    while (j < a->n || k < b->n) {
-        int a_node = j == a->n ? INT_MAX : a->nodes[j];
-        int b_node = k == b->n ? INT_MAX : b->nodes[k];
-
-        if (a_node < b_node) {
-            j++;
-        } else if (b_node < a_node) {
-            k++;
-        } else { // b_node == a_node
-            i++;
-            j++;
-            k++;
-        }
+// c's nodeset, built on first use. Threads checking pairs may ask for the same community's set at once.
+// index_update and freeCommunity take care of freeing it
+nodeset *communitySet(community *c) {
+    if (c->set == NULL) {
+#pragma omp critical(nodeset)
+        if (c->set == NULL)
+            c->set = nodesetBuild(c->nodes, c->n);
     }
-
-    return i;
+    return c->set;
 }
 
+// free a community that isn't part of an index, e.g. the temporary ones from setMinus and merge
+void freeCommunity(community *c) {
+    if (c == NULL)
+        return;
+    nodesetFree(c->set);
+    free(c->fiedler);
+    free(c->nodes);
+    free(c);
+}
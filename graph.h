@@ -6,27 +6,134 @@
 #define MPICOMM_GRAPH_H
 
 #include "stdio.h"
+#include <math.h>
 #include "lib.h"
 
-typedef struct {
+typedef struct graph {
     int n;
     int e;
     // dense list of all edges, each node's neighbor IDs stored contiguously. unsuitable for mutation
     int *edgelist;
     // nodemap[i] is the first index of node i's neighbor IDs in edgelist
     int *nodemap;
+    // if loaded via fromBinary, the read-only file mapping that nodemap and edgelist point into. else NULL
+    void *mapping;
+    size_t mapping_size;
+    // if compressed via compressGraph, nodemap and edgelist are NULL and node i's adjacency is stored at
+    // cedges[coffsets[i]] as varints: its degree, then the gaps between its sorted neighbors (the first gap is from 0)
+    unsigned char *cedges;
+    size_t *coffsets;
+    // if partitioned across ranks (see partition.h), all of the above are NULL and rows[i] points to node i's degree
+    // followed by its sorted neighbors. rows of nodes stored on other ranks are NULL until fetch brings them in
+    int **rows;
+    int *(*fetch)(struct graph *g, int u);
+    void *part;
 } graph;
 
+// Iterates over a node's sorted neighbors, regardless of whether the graph is compressed. Usage:
+//   neighbor_iter it; int v;
+//   neighbors(g, u, &it);
+//   while (nextNeighbor(&it, &v)) ...
+typedef struct {
+    const int *plain;           // next neighbor in edgelist, if not compressed
+    const unsigned char *bytes; // next gap in cedges, if compressed
+    int remaining;
+    int current;
+} neighbor_iter;
+
+static inline unsigned int readVarint(const unsigned char **p) {
+    const unsigned char *q = *p;
+    unsigned int x = *q & 0x7f;
+    int shift = 7;
+    while (*q++ & 0x80) {
+        x |= (unsigned int) (*q & 0x7f) << shift;
+        shift += 7;
+    }
+    *p = q;
+    return x;
+}
+
+static inline void neighbors(graph *g, int u, neighbor_iter *it) {
+    it->current = 0;
+    if (g->edgelist != NULL) {
+        it->plain = g->edgelist + g->nodemap[u];
+        it->bytes = NULL;
+        it->remaining = g->nodemap[u + 1] - g->nodemap[u];
+    } else if (g->rows != NULL) {
+        const int *row = g->rows[u] != NULL ? g->rows[u] : g->fetch(g, u);
+        it->plain = row + 1;
+        it->bytes = NULL;
+        it->remaining = row[0];
+    } else {
+        it->plain = NULL;
+        it->bytes = g->cedges + g->coffsets[u];
+        it->remaining = readVarint(&it->bytes);
+    }
+}
+
+// stores the next neighbor in v and returns 1, or returns 0 if there are none left
+static inline int nextNeighbor(neighbor_iter *it, int *v) {
+    if (it->remaining == 0)
+        return 0;
+    it->remaining--;
+
+    if (it->plain != NULL)
+        *v = *it->plain++;
+    else
+        *v = it->current += readVarint(&it->bytes);
+
+    return 1;
+}
+
+// Binary CSR file layout: csr_header, nodemap (n + 1 ints), edgelist (e ints), all in host byte order.
+// Node ids are 0-indexed and neighbor lists are sorted, i.e. the arrays are stored exactly as graph holds them.
+#define CSR_MAGIC 0x52534347 // "GCSR" in little endian
+#define CSR_VERSION 1
+
+typedef struct {
+    int magic;
+    int version;
+    int n;
+    int e; // length of edgelist, i.e. twice the number of undirected edges
+} csr_header;
+
+// ev of a community whose lambda 2 isn't known yet. Disconnected communities have lambda 2 = 0, so 0 can't mean that
+#define EV_UNKNOWN NAN
+
 typedef struct community {
     int id;
-    float ev;
+    float ev; // EV_UNKNOWN until computed or received
     int n;
     int *nodes; // list of nodes in this community
-    struct community* sibling; // If this community is merged with another one, this points to the merge partner
-    struct community* parent; // If this community's sibling is again merged, this points to the result of that.
-    // So if the parent is not NULL, then this community is a "ghost entry" which only exists for the inverse index
+    struct nodeset* set; // array/bitmap view of nodes for large communities, built on demand by communitySet()
+    float *fiedler; // Fiedler vector as node potentials D^-1/2 y, if ev was computed with Lanczos. see spectral.h
 } community;
 
+// Per-worker node marks for counting edges in O(sum of degrees). Instead of clearing the marks after every count,
+// each count uses fresh epoch values, so only a wrap-around of epoch needs a reset
+typedef struct edge_counter {
+    unsigned int *stamp; // stamp[u] is epoch, epoch + 1 or epoch + 2 if u is in the overlap, a or c of the current count
+    unsigned int epoch;
+    int n;
+} edge_counter;
+
+// Edge counts of a candidate merge, split into the disjoint parts a and c and their overlap
+typedef struct pair_edges {
+    int disjoint;   // edges between a and c
+    int inner;      // edges within the larger of a and c
+    int a_overlap;  // edges between a and the overlap
+    int c_overlap;
+    long a_volume;  // sum of the degrees within the merged community of a's nodes
+    long c_volume;
+    int isolated;   // nodes of a or c without a neighbor in the merged community
+} pair_edges;
+
+edge_counter *edgeCounterNew(graph *g);
+
+void edgeCounterFree(edge_counter *ec);
+
+void countPairEdges(graph *g, edge_counter *ec, community *a, community *c, community *merged, pair_edges *out);
+
 void communityIsMessedUp(community *a);
 
 int hasEdge(graph *g, int u, int v);
@@ -35,14 +142,50 @@ int edgesBetweenSubsets(graph *g, community *a, community *b);
 
 graph *fromMetis(FILE *f);
 
+graph *fromBinary(char *filename);
+
+int toBinary(graph *g, char *filename);
+
+graph *loadGraph(char *filename);
+
+void freeGraph(graph *g);
+
+void compressGraph(graph *g);
+
+int nodeDegree(graph *g, int u);
+
 matrix *subgraph(graph *g, community *c);
 
+void subgraphInto(graph *g, community *c, matrix *adj);
+
+// Maps c's nodes to their indices in c in the calling thread's graph-sized lookup table, every other node maps to -1.
+// releaseLocalIndex(c) resets the table once done
+int *localIndex(graph *g, community *c);
+
+void releaseLocalIndex(community *c);
+
+// toLaplacianInto(subgraph(g, c)) in one pass over the edges of c's nodes, without the adjacency matrix. Writes the
+// lower triangle and clears the upper one, and writes each node's degree within c to degrees
+void laplacianInto(graph *g, community *c, matrix *laplacian, ev_real *degrees);
+
 float communityEv(community *c, graph *g);
 
+float mergedCommunityEv(community *merged, community *a, community *b, graph *g);
+
+int knownEv(community *c);
+
+// mergedCommunityEv at full precision, even if the ev is known already. For decisions within ev_tolerance of the
+// boundary
+float exactCommunityEv(community *merged, community *a, community *b, graph *g);
+
 float laplacianEv(matrix *adj);
 
 community *merge(community *a, community *b);
 
+struct nodeset *communitySet(community *c);
+
+void freeCommunity(community *c);
+
 void printCommunity(community *c);
 
 void printGraph(graph *g);
@@ -6,9 +6,15 @@
 #include <string.h>
 #include <math.h>
 #include <limits.h>
+#include <stdint.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "index.h"
 #include "lib.h"
+#include "nodeset.h"
 
 
 
@@ -20,8 +26,6 @@
 #endif
 
 int currentCommunityId = 0;
-int appends_since_last_rebuild = 0;
-int max_appends_till_rebuild = 0;
 
 // helper method for index_create, move cs to a new community* array of size $size
 community **expandCapacity(community **cs, int old_size, int new_size) {
@@ -33,19 +37,121 @@ community **expandCapacity(community **cs, int old_size, int new_size) {
     return new;
 }
 
-// Read communities given by .nl file into index struct
-
-c_index *index_create(char *filename, graph *g) {
-    // setup index
+// helper for the index_create variants, sets up an empty index over g
+c_index *index_new(graph *g) {
     c_index * ind = malloc(sizeof(c_index));
     ind->n = g->n;
     ind->g = g;
     ind->communities = calloc(g->n, sizeof(community*));
     ind->lengths = calloc(g->n, sizeof(int)); // lengths[i] = number of nonzero community* that ind->communities[i] holds
     ind->list = cl_new();
+    ind->uf_parent = NULL;
+    ind->uf_size = NULL;
+    ind->uf_live = NULL;
+    ind->uf_capacity = 0;
+    ind->stale_hits = calloc(g->n, sizeof(int));
+    ind->mapping = NULL;
+    ind->mapping_size = 0;
+    return ind;
+}
+
+// adds c to the list of live communities, as its own set in the union-find
+static void index_append(c_index *ind, community *c) {
+    int id = c->id;
+    if (id >= ind->uf_capacity) {
+        int capacity = ind->uf_capacity > 0 ? ind->uf_capacity : 1024;
+        while (capacity <= id)
+            capacity *= 2;
+        ind->uf_parent = realloc(ind->uf_parent, capacity * sizeof(int));
+        ind->uf_size = realloc(ind->uf_size, capacity * sizeof(int));
+        ind->uf_live = realloc(ind->uf_live, capacity * sizeof(community*));
+        ind->uf_capacity = capacity;
+    }
+
+    ind->uf_parent[id] = id;
+    ind->uf_size[id] = 1;
+    ind->uf_live[id] = c;
+    cl_append(ind->list, c);
+}
+
+// root of id's set, with path compression
+static int uf_find(c_index *ind, int id) {
+    int root = id;
+    while (ind->uf_parent[root] != root)
+        root = ind->uf_parent[root];
+
+    while (ind->uf_parent[id] != root) {
+        int next = ind->uf_parent[id];
+        ind->uf_parent[id] = root;
+        id = next;
+    }
+    return root;
+}
+
+community *index_resolve(c_index *ind, community *c) {
+    return ind->uf_live[uf_find(ind, c->id)];
+}
+
+static int compare_pointers(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) *(community* const*) a;
+    uintptr_t y = (uintptr_t) *(community* const*) b;
+    return x < y ? -1 : x > y;
+}
+
+int index_compact_node(c_index *ind, int node) {
+    community** cs = ind->communities[node];
+    int n = ind->lengths[node];
+
+    // entries may always be replaced by what they resolve to, which also saves resolving them again later
+    int i;
+    for (i = 0; i < n; i++)
+        cs[i] = index_resolve(ind, cs[i]);
+    qsort(cs, n, sizeof(community*), compare_pointers);
+
+    int distinct = 0;
+    for (i = 0; i < n; i++)
+        if (distinct == 0 || cs[i] != cs[distinct - 1])
+            distinct++;
+
+    if (n - distinct <= INDEX_STALE_RATIO * n)
+        return 0;
+
+    distinct = 0;
+    for (i = 0; i < n; i++)
+        if (distinct == 0 || cs[i] != cs[distinct - 1])
+            cs[distinct++] = cs[i];
+    ind->lengths[node] = distinct;
+    return 1;
+}
+
+void index_stale_hit(c_index *ind, int node) {
+    if (++ind->stale_hits[node] * 4 < ind->lengths[node])
+        return;
+    ind->stale_hits[node] = 0;
+    index_compact_node(ind, node);
+}
+
+// Read communities given by .nl file or binary community file into index struct
+c_index *index_create(char *filename, graph *g) {
+    FILE* f = fopen(filename, "r");
+    if (f == NULL) {
+        printf("could not open %s. exiting...\n", filename);
+        exit(1);
+    }
+
+    int magic = 0;
+    int is_binary = fread(&magic, sizeof(int), 1, f) == 1 && magic == CNL_MAGIC;
+    fclose(f);
+
+    return is_binary ? index_create_binary(filename, g) : index_create_nl(filename, g);
+}
+
+c_index *index_create_nl(char *filename, graph *g) {
+    // setup index
+    c_index * ind = index_new(g);
 
     int initial_size = 2 * g->e / g->n; // initially allocate 2 * avg degree for each node
-    int allocated[g->n]; // allocated[i] = number of community* that ind->communities[i] has malloced for
+    int* allocated = malloc(g->n * sizeof(int)); // allocated[i] = number of community* that ind->communities[i] has malloced for
 
     int i;
     for (i = 0; i < g->n; i++) {
@@ -60,7 +166,7 @@ c_index *index_create(char *filename, graph *g) {
     char ch; // current character
 
     i = 0; // number of current community
-    int buf[g->n]; // buffer holding all nodes that belong to this community so far
+    int* buf = malloc(g->n * sizeof(int)); // buffer holding all nodes that belong to this community so far
     int buf_pos = 0; // current index in buffer
 
     community* c = malloc(sizeof(community)); // current community
@@ -97,9 +203,9 @@ c_index *index_create(char *filename, graph *g) {
             c->id = currentCommunityId++;
             c->n = buf_pos;
             c->nodes = malloc(buf_pos * sizeof(int));
-            c->ev = 0;
-            c->sibling = NULL;
-            c->parent = NULL;
+            c->ev = EV_UNKNOWN;
+            c->set = NULL;
+            c->fiedler = NULL;
 
             // copy buffer into community
             int k;
@@ -108,7 +214,7 @@ c_index *index_create(char *filename, graph *g) {
             }
 
             // add community to sorted list
-            cl_append(ind->list, c);
+            index_append(ind, c);
 
             // setup for parsing next community
             i++;
@@ -121,466 +227,335 @@ c_index *index_create(char *filename, graph *g) {
         }
     }
 
-    sl_rebuild(ind->list);
+    free(c);
+    free(buf);
+    free(allocated);
+    fclose(f);
 
 #ifdef DEBUG2
     puts("finished parsing communities:");
     cl_print(ind->list);
-    sl_print(ind->list->skip_list);
 #endif
 
     return ind;
 }
 
-void index_update(c_index *ind, community *a, community *b, community *merged) {
-    free(a->nodes);
-    free(b->nodes);
-
-    merged->id = currentCommunityId++;
-
-#ifdef DEBUG
-    printf("\n--------------- ITEMS: %d %d\n\n", a->id, b->id);
-    cl_print(ind->list);
-    sl_print(ind->list->skip_list);
-#endif
-
-    cl_remove(ind->list, a->id);
-    cl_remove(ind->list, b->id);
-
-#ifdef DEBUG
-    puts("\nREMOVED\n");
-    cl_print(ind->list);
-    sl_print(ind->list->skip_list);
-#endif
-
-    /*
-     * We're just cloning the merged community into a and b. That means it might appear twice in the inverse index's
-     * list of communities for a given node.
-     *
-     * This gives it a higher probability of getting selected in a dice roll in tryMergeRandomPair(),
-     * but rolls are cheap, so it probably doesn't matter.
-     */
-    a->n     = b->n     = merged->n;
-    a->ev    = b->ev    = merged->ev;
-    a->id    = b->id    = merged->id;
-    a->nodes = b->nodes = merged->nodes;
-
-    /*
-     * We also run into an issue though. Say we later merge a, and it gets deleted from the community list.
-     * b however still exists in the inverse index. Thus it might be randomly selected, even though the community
-     * it represents has already been merged. Therefore, merged communities keep a pointer to their clone/sibling
-     * community and when they get merged, the sibling is marked dead and won't get randomly selected anymore.
-     * (It'll only get rolled, but again rolls are cheap)
-     */
-    if (a->sibling != NULL)
-        a->sibling->parent = a;
-    if (b->sibling != NULL)
-        b->sibling->parent = b;
-
-    a->sibling = b;
-    b->sibling = a;
-
-    // In the list of communities, we just append the merged community once.
-    cl_append(ind->list, a);
-
-#ifdef DEBUG
-    puts("\nAPPENDED\n");
-    cl_print(ind->list);
-    sl_print(ind->list->skip_list);
-#endif
-
-    // We periodically need to rebuild the skip list because it'll degenerate as we append.
-    appends_since_last_rebuild++;
-    if (appends_since_last_rebuild > max_appends_till_rebuild) {
-        sl_rebuild(ind->list);
-
-#ifdef DEBUG
-        printf("passed %d appends since last rebuild. rebuilding:", max_appends_till_rebuild);
-        cl_print(ind->list);
-        sl_print(ind->list->skip_list);
-#endif
+// mmap a binary community file and build the index straight from it. the communities' node arrays point into
+// the mapping, so nothing is parsed or copied, and all per-node community lists share a single allocation
+c_index *index_create_binary(char *filename, graph *g) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        printf("could not open %s. exiting...\n", filename);
+        exit(1);
     }
-}
 
+    struct stat st;
+    fstat(fd, &st);
 
-void index_print(c_index *ind) {
-    int i, j;
-    puts("printing index:");
-    for (i = 0; i < ind->n; i++) {
-        printf("\tnode %d of %d:\n", i, ind->n);
-        for (j = 0; j < ind->lengths[i]; j++) {
-            printf("\t\t");
-            printCommunity(ind->communities[i][j]);
-        }
+    if ((size_t) st.st_size < sizeof(cnl_header)) {
+        printf("%s is too small to be a binary community file. exiting...\n", filename);
+        exit(1);
     }
-}
 
-community_list* cl_new() {
-    community_list* cl = malloc(sizeof(community_list));
-    cl->n = 0;
-    cl->first = NULL;
-    cl->last = NULL;
-    cl->skip_list = NULL;
-
-    return cl;
-}
+    void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
 
-community_list_item* cl_new_item(community* community) {
-    community_list_item* i = malloc(sizeof(community_list_item));
-    i->item = community;
-    i->next = NULL;
-    i->sl_item = NULL;
-    return i;
-}
-
-void cl_remove(community_list* list, int id) {
-    if (id < 0)
-        puts("WARNING: ID IS NEGATIVE");
-
-    community_list_item* leftNeighbor = cl_find_nearest_leq(list, id-1);
-
-    if (leftNeighbor == NULL) {
-        // Handle first item case
-        if (list->first->item->id == id) {
-            community_list_item* second = list->first->next;
-
-            if (list->first->sl_item != NULL) {
-                // if second is NOT pointed to by a sli, we just give first's sli to second.
-                if (second->sl_item != NULL) {
-                    second->sl_item = list->first->sl_item;
-                    list->first->sl_item->item = second; // if a skiplist item is pointing to this, move it on to the second
-
-                    free(list->first);
-                    list->first = second;
+    if (mapping == MAP_FAILED) {
+        printf("could not mmap %s. exiting...\n", filename);
+        exit(1);
+    }
 
-                // if we're here, first AND second are pointed to by a sli, which means we need to fix our skiplist
-                // I just rebuild it cause im lazy
-                } else {
-                    free(list->first);
-                    list->first = second;
+    cnl_header* header = mapping;
+    int* offsets = (int*) (header + 1);
+    int* nodes = offsets + header->count + 1;
 
-                    sl_rebuild(list);
-                }
-            }
+    if (header->magic != CNL_MAGIC || header->version != CNL_VERSION || header->count < 0 || header->total < 0
+        || (size_t) st.st_size != sizeof(cnl_header) + sizeof(int) * ((size_t) header->count + 1 + header->total)) {
+        printf("%s is not a binary community file (version %d) or is corrupt. exiting...\n", filename, CNL_VERSION);
+        exit(1);
+    }
 
-        } else {
-            cl_print(list);
-            sl_print(list->skip_list);
-            puts("Can't find left neighbor of item to delete.");
-            printf("item id = %d\n", id);
-            fflush(stdout); // forgot this zzz
-            community_list_item* segfault = NULL;
-            segfault->sl_item = NULL;
+    // the offsets slice the node array, so they must stay inside it before anything is read through them
+    int i, k;
+    for (i = 0; i < header->count; i++) {
+        if (offsets[i] < 0 || offsets[i] > offsets[i + 1]) {
+            printf("file %s has decreasing community offsets. exiting...\n", filename);
+            exit(1);
         }
+    }
+    if (offsets[0] != 0 || offsets[header->count] != header->total) {
+        printf("file %s has community offsets that don't span its %d node ids. exiting...\n", filename, header->total);
+        exit(1);
+    }
 
-    } else if (leftNeighbor->next->item->id != id) {
-        cl_print(list);
-        sl_print(list->skip_list);
-        puts("Can't find item to delete.");
-        printf("item id = %d, left neighbor id = %d, left->next id = %d\n", id, leftNeighbor->item->id, leftNeighbor->next->item->id);
-        fflush(stdout);
-        community_list_item* segfault = NULL;
-        segfault->sl_item = NULL;
-
-    } else {
-        community_list_item* rightNeighbor = leftNeighbor->next->next;
-
-        // Fixup last item ptr if needed
-        if (leftNeighbor->next == list->last)
-            list->last = leftNeighbor;
-
-        // If the element to be deleted is pointed to by a sli, we move the sli's pointer to the left neighbor
-        if (leftNeighbor->next->sl_item != NULL) {
-#ifdef LOG
-            puts("deleting cli that's pointed to by a sli. fixing up sl...");
-#endif
-            // same as with the first item case, the right neighbor might already have a sl_item which is handled in the else case
-            if (leftNeighbor->sl_item == NULL) {
-                leftNeighbor->sl_item = leftNeighbor->next->sl_item;
-                leftNeighbor->next->sl_item->item = leftNeighbor; // if a skiplist item is pointing to this, move it on to leftNeighbor
-
-                free(leftNeighbor->next);
-                leftNeighbor->next = rightNeighbor;
-
-            // if we're here there are two items directly next to each other each pointed to by a sli, so rebuild skiplist
-            } else {
-                free(leftNeighbor->next);
-                leftNeighbor->next = rightNeighbor;
+    c_index* ind = index_new(g);
+    ind->mapping = mapping;
+    ind->mapping_size = st.st_size;
 
-                sl_rebuild(list);
+    // count how many communities each node is in
+    for (i = 0; i < header->count; i++) {
+        for (k = offsets[i]; k < offsets[i + 1]; k++) {
+            if (nodes[k] < 0 || nodes[k] >= g->n || (k > offsets[i] && nodes[k] < nodes[k - 1])) {
+                printf("file %s is not sorted or has node ids out of range. exiting...\n", filename);
+                exit(1);
             }
-
-        } else {
-            free(leftNeighbor->next);
-            leftNeighbor->next = rightNeighbor;
+            ind->lengths[nodes[k]]++;
         }
-
     }
 
-    list->n--;
-    if ((int) floor(sqrt(list->n)) != list->skip_list->n) {
-        sl_rebuild(list);
+    // carve every node's community list out of one allocation
+    community** slots = malloc((header->total > 0 ? header->total : 1) * sizeof(community*));
+    int used = 0;
+    for (i = 0; i < g->n; i++) {
+        ind->communities[i] = slots + used;
+        used += ind->lengths[i];
+        ind->lengths[i] = 0;
     }
-}
 
-// O(1) append community. Community id MUST be higher than any other in sl. Caller has to rebuild sl.
-void cl_append(community_list* list, community* community) {
-    community_list_item* new_item = cl_new_item(community);
-
-    if (list->last == NULL) {
-        list->first = list->last = new_item;
-        list->skip_list = sl_new(list->first);
-    } else {
-        list->last->next = new_item;
-        list->last = new_item;
-        list->skip_list->last->maxid = new_item->item->id;
+    community* cs = malloc((header->count > 0 ? header->count : 1) * sizeof(community));
+    for (i = 0; i < header->count; i++) {
+        community* c = &cs[i];
+        c->id = currentCommunityId++;
+        c->n = offsets[i + 1] - offsets[i];
+        c->nodes = nodes + offsets[i];
+        c->ev = EV_UNKNOWN;
+        c->set = NULL;
+        c->fiedler = NULL;
+
+        for (k = 0; k < c->n; k++) {
+            int node = c->nodes[k];
+            ind->communities[node][ind->lengths[node]++] = c;
+        }
+
+        index_append(ind, c);
     }
 
-    list->n++;
+    return ind;
 }
 
-// Insert a community into list, maintaining sort by id
-void cl_insert(community_list* list, community* community) {
-    community_list_item* new_item = cl_new_item(community);
-
-    // Handle empty list case
-    if (list->first == NULL) {
-        list->first = list->last = new_item;
-        list->skip_list = sl_new(list->first);
-
-    // Else insert normally.
-    } else {
-        community_list_item* leftNeighbor = cl_find_nearest_leq(list, community->id);
-
-        // Can only occur if community->id is smaller than everything in the list
-        // (or list is empty which is impossible because handled above.)
-        if (leftNeighbor == NULL) {
-            // Insert as first item
-            community_list_item* next = list->first;
-            list->first = new_item;
-            new_item->next = next;
-
-        } else {
-            community_list_item* next = leftNeighbor->next; // next may be NULL
-            leftNeighbor->next = new_item;
-            new_item->next = next;
+// Convert a .nl community file to the binary format read by index_create_binary. returns 0 on success
+int index_write_binary(char *nl_filename, char *out_filename) {
+    FILE* in = fopen(nl_filename, "r");
+    if (in == NULL)
+        return 1;
+
+    int capacity = 1024;
+    int* nodes = malloc(capacity * sizeof(int));
+    int offsets_capacity = 1024;
+    int* offsets = malloc(offsets_capacity * sizeof(int));
+
+    cnl_header header;
+    header.magic = CNL_MAGIC;
+    header.version = CNL_VERSION;
+    header.count = 0;
+    header.total = 0;
+    offsets[0] = 0;
+
+    int node = 0;
+    int in_number = 0;
+    int ch;
+    while ((ch = getc(in)) != EOF) {
+        if (ch >= '0' && ch <= '9') {
+            node = node * 10 + (ch - '0');
+            in_number = 1;
+            continue;
         }
-    }
-
-    list->n++;
 
-    // If necessary, rebuild skip list
-    if ((int) floor(sqrt(list->n)) != list->skip_list->n) {
-        sl_rebuild(list);
-    }
-}
+        if (in_number) {
+            if (header.total == capacity) {
+                capacity *= 2;
+                nodes = realloc(nodes, capacity * sizeof(int));
+            }
+            nodes[header.total++] = node - 1; // .nl files are 1-indexed
+            node = 0;
+            in_number = 0;
+        }
 
-community* cl_linear_find(community_list* list, int id) {
-    community_list_item* cur = list->first;
-    while (cur != NULL) {
-        if (cur->item->id == id)
-            return cur->item;
-        cur = cur->next;
+        if (ch == '\n') {
+            if (header.count + 2 > offsets_capacity) {
+                offsets_capacity *= 2;
+                offsets = realloc(offsets, offsets_capacity * sizeof(int));
+            }
+            offsets[++header.count] = header.total;
+        }
     }
-    return NULL;
-}
-
-community* cl_find(community_list* list, int id) {
-    community_list_item* i = cl_find_nearest_leq(list, id);
-    if (i == NULL) {
-        //printf("%d: id %d: got back NULL (should mean even first id %d is smaller)\n", world_rank, id, list->first->item->id);
-        return NULL;
-    } else if (i->item->id != id) {
-        //printf("%d: id %d: only got back leq id %d\n", world_rank, id, i->item->id);
-        return NULL;
-    } else
-        return i->item;
-}
+    fclose(in);
 
-// Find community_list_item* with id nearest to and smaller than or equal to param id
-community_list_item* cl_find_nearest_leq(community_list* list, int id) {
-    skip_list_item* sli = list->skip_list->first;
-    int iters = 0;
-
-    while(sli->maxid < id && sli->next != NULL) {
-        sli = sli->next;
-        iters++;
+    if (in_number) { // no newline at EOF
+        printf("file %s does not end with a newline\n", nl_filename);
+        return 1;
     }
 
-#ifdef DEBUG
-    printf("found appropriate sl item for %d with max id %d after %d iters\n", id, sli->id, iters);
-#endif
+    FILE* out = fopen(out_filename, "wb");
+    if (out == NULL)
+        return 1;
 
-    community_list_item* cli = sli->item;
-    community_list_item* next;
-    iters = 0;
+    int ok = fwrite(&header, sizeof(cnl_header), 1, out) == 1
+             && fwrite(offsets, sizeof(int), header.count + 1, out) == (size_t) header.count + 1
+             && fwrite(nodes, sizeof(int), header.total, out) == (size_t) header.total;
 
-#ifdef DEBUG
-    printf("begin looking for %d at cli id %d\n", id, cli->item->id);
-#endif
+    free(nodes);
+    free(offsets);
 
-    while(cli->next != NULL) {
-        iters++;
-        next = cli->next;
+    return fclose(out) != 0 || !ok;
+}
 
-        // found nearest leq
-        if (next->item->id > id)
-            break;
+// node arrays of communities loaded by index_create_binary live in the file mapping and must not be freed
+void index_free_nodes(c_index *ind, community *c) {
+    nodesetFree(c->set);
+    c->set = NULL;
+    free(c->fiedler);
+    c->fiedler = NULL;
+
+    char* p = (char*) c->nodes;
+    char* base = ind->mapping;
+    if (base == NULL || p < base || p >= base + ind->mapping_size)
+        free(c->nodes);
+    c->nodes = NULL;
+    c->n = 0;
+}
 
-        cli = next;
-    }
+// Replaces the live communities a and b by merged. a and b are left as empty shells with their ids, since the inverse
+// index may still point to them, and their sets in the union-find are joined to resolve to merged
+void index_update(c_index *ind, community *a, community *b, community *merged) {
+    index_free_nodes(ind, a);
+    index_free_nodes(ind, b);
 
-    community_list_item* ret = cli->item->id > id ? NULL : cli;
+    merged->id = currentCommunityId++;
 
 #ifdef DEBUG
-    printf("found leq cl item %d for id %d after %d iters (sli id=%d, ptr=%d). returning %p\n", cli->item->id, id, iters, sli->id, sli->item->item->id, ret);
+    printf("\n--------------- ITEMS: %d %d\n\n", a->id, b->id);
 #endif
 
-    return ret;
+    cl_remove(ind->list, a->id);
+    cl_remove(ind->list, b->id);
+    index_append(ind, merged);
+
+    // union by size, merged's id joins the larger set too
+    int ra = uf_find(ind, a->id);
+    int rb = uf_find(ind, b->id);
+    int root = ind->uf_size[ra] >= ind->uf_size[rb] ? ra : rb;
+    int other = root == ra ? rb : ra;
+    ind->uf_parent[other] = root;
+    ind->uf_parent[merged->id] = root;
+    ind->uf_size[root] += ind->uf_size[other] + 1;
+    ind->uf_live[root] = merged;
 }
 
-skip_list_item* sl_new_item(community_list_item* c) {
-    skip_list_item* sli = malloc(sizeof(skip_list_item));
 
-    if (c != NULL) {
-        sli->item = c;
-        sli->maxid = c->item->id;
+void index_print(c_index *ind) {
+    int i, j;
+    puts("printing index:");
+    for (i = 0; i < ind->n; i++) {
+        printf("\tnode %d of %d:\n", i, ind->n);
+        for (j = 0; j < ind->lengths[i]; j++) {
+            printf("\t\t");
+            printCommunity(ind->communities[i][j]);
+        }
     }
-
-    sli->next = NULL;
-
-    return sli;
 }
 
-skip_list* sl_new(community_list_item* c) {
-    skip_list* sl = malloc(sizeof(skip_list));
-
-    sl->n = 1;
-    sl->first = sl_new_item(c);
-    sl->last = sl->first;
+community_list* cl_new() {
+    community_list* cl = malloc(sizeof(community_list));
+    cl->n = 0;
+    cl->maxid = -1;
+    cl->capacity = 1024;
+    cl->items = calloc(cl->capacity, sizeof(community*));
 
-    return sl;
+    return cl;
 }
 
-// O(n) where n is number of communities in cl
-// Grow or shrink skip list. Reuses old skip list to the extent possible
-void sl_rebuild(community_list* list) {
-    int n = (int) floor(sqrt(list->n));
-
-#ifdef LOG
-    printf("rebuilding sl from n=%d to %d for cl n=%d\n", list->skip_list->n, n, list->n);
-#endif
-
-#ifdef DEBUG2
-    cl_print(list);
-#endif
-
-    list->skip_list->n = n;
-    max_appends_till_rebuild = 2 * n;
-    appends_since_last_rebuild = 0;
-
-    skip_list_item* current_sli = list->skip_list->first;
-    skip_list_item* next_sli = current_sli;
-
-    // get rid of old skiplist if exists
-    while (current_sli != NULL) {
-        next_sli = current_sli->next;
-        free(current_sli);
-        current_sli = next_sli;
-    }
-
-    community_list_item *current_cli = list->first;
-
-    while (current_cli != NULL) {
-        current_cli->sl_item = NULL;
-        current_cli = current_cli->next;
+void cl_remove(community_list* list, int id) {
+    if (id < 0 || id > list->maxid || list->items[id] == NULL) {
+        printf("Can't find item to delete.\nitem id = %d, max id = %d\n", id, list->maxid);
+        fflush(stdout);
+        community_list* segfault = NULL;
+        segfault->n = 0;
     }
 
-    current_cli = list->first;
-    community_list_item *prev_cli = list->first;
-
-    int i;
-    for (i = 0; i < n; i++) {
-        int id;
-
-        // Create first or next skip list item
-        if (current_sli == NULL) {
-            list->skip_list->first = sl_new_item(NULL);
-            current_sli = list->skip_list->first;
-        } else {
-            current_sli->next = sl_new_item(NULL);
-            current_sli = current_sli->next;
-        }
-
-        // Find this segment's cli and id
-        int j;
-        for (j = 0; j < n; j++) {
-            // next may be NULL at the end?
-            if (current_cli->next != NULL) {
-                current_cli = current_cli->next;
-                id = current_cli->item->id;
-            } else {
-                id = INT_MAX;
-            }
-        }
-
-        current_sli->maxid = id;
-        current_sli->item = prev_cli;
-        prev_cli->sl_item = current_sli;
+    list->items[id] = NULL;
+    list->n--;
+}
 
-        prev_cli = current_cli;
-    }
+// O(1) amortized, the table grows by doubling
+void cl_append(community_list* list, community* community) {
+    cl_insert(list, community);
+}
 
-    // Add a final skip list item for potential leftover communities from rounding n down
-    if (current_cli != list->last) {
-        current_sli->next = sl_new_item(NULL);
-        current_sli = current_sli->next;
-        current_sli->maxid = list->last->item->id;
-        current_sli->item = current_cli;
-        current_cli->sl_item = current_sli;
+// Insert a community into list under its id
+void cl_insert(community_list* list, community* community) {
+    int id = community->id;
+    if (id >= list->capacity) {
+        int capacity = list->capacity;
+        while (capacity <= id)
+            capacity *= 2;
+        list->items = realloc(list->items, capacity * sizeof(*list->items));
+        memset(list->items + list->capacity, 0, (capacity - list->capacity) * sizeof(*list->items));
+        list->capacity = capacity;
     }
 
-    list->skip_list->last = current_sli;
-
-#ifdef LOG
-    cl_benchmark(list, 1000);
-#endif
-
-#ifdef DEBUG
-    sl_print(list->skip_list);
-#endif
-
-    cl_check_integrity(list);
+    if (list->items[id] == NULL)
+        list->n++;
+    list->items[id] = community;
+    if (id > list->maxid)
+        list->maxid = id;
 }
 
-void sl_print(skip_list * sl) {
-    skip_list_item* current = sl->first;
-    int i = 0;
-    puts("sl:");
-    while(current != NULL) {
-        printf("\t%d: maxid %d points to id %d\n", i++, current->maxid, current->item->item->id);
-        current = current->next;
-    }
+community* cl_find(community_list* list, int id) {
+    if (id < 0 || id > list->maxid)
+        return NULL;
+    return list->items[id];
 }
 
 void cl_print(community_list* cl) {
-    community_list_item* current = cl->first;
-    int i = 0;
+    int id;
     puts("cl:");
-    printf("\tfirst: %d\n", cl->first->item->id);
-    printf("\tlast: %d\n", cl->last->item->id);
+    printf("\tmax id: %d\n", cl->maxid);
     puts("\titems:");
-    while (current != NULL) {
-        printf("\t\t%d: id %d", i++, current->item->id);
+    for (id = 0; id <= cl->maxid; id++) {
+        if (cl->items[id] == NULL)
+            continue;
+        printf("\t\tid %d\n", id);
+        printCommunity(cl->items[id]);
+    }
+}
 
-        if (current->sl_item != NULL) {
-            printf(" (sli: maxid %d points to %d)", current->sl_item->maxid, current->sl_item->item->item->id);
+// Write every live community as one line of 1-indexed node ids, i.e. in the same .nl format we read.
+// If original_ids is given (see index_read_nodemap), node i is written as original_ids[i]
+void cl_write(community_list* cl, FILE* f, int* original_ids) {
+    int id;
+    for (id = 0; id <= cl->maxid; id++) {
+        community* c = cl->items[id];
+        if (c == NULL)
+            continue;
+        int i;
+        for (i = 0; i < c->n; i++) {
+            int node = original_ids == NULL ? c->nodes[i] + 1 : original_ids[c->nodes[i]];
+            fprintf(f, i == 0 ? "%d" : " %d", node);
         }
+        fputc('\n', f);
+    }
+}
+
+// Read the node id table written by preprocess: line i holds the original 1-indexed id of node i
+int* index_read_nodemap(char* filename, int n) {
+    FILE* f = fopen(filename, "r");
+    if (f == NULL) {
+        printf("could not open %s. exiting...\n", filename);
+        exit(1);
+    }
 
-        puts("");
-        printCommunity(current->item);
-        current = current->next;
+    int* original_ids = malloc(n * sizeof(int));
+    int i;
+    for (i = 0; i < n; i++) {
+        if (fscanf(f, "%d", &original_ids[i]) != 1) {
+            printf("file %s has fewer than %d node ids. exiting...\n", filename, n);
+            exit(1);
+        }
     }
+
+    fclose(f);
+    return original_ids;
 }
 
 void index_print_meta(c_index* ind) {
@@ -594,85 +569,40 @@ void cl_benchmark(community_list* cl, int n) {
 
     puts("benching...");
 
-    // Bench skip list find
+    // Bench find
     clock_gettime(CLOCK_MONOTONIC, &tstart);
     int i;
     for (i = 0; i < n; i++) {
-        int find = randInt(0, cl->n);
+        int find = randInt(0, cl->maxid + 1);
         cl_find(cl, find);
     }
     clock_gettime(CLOCK_MONOTONIC, &tend);
     double seconds = ((double)tend.tv_sec + 1.0e-9*tend.tv_nsec) - ((double)tstart.tv_sec + 1.0e-9*tstart.tv_nsec);
     printf("\tfinding %d items took about %.5f seconds\n", n, seconds);
 
-    // Bench linear find (commented out cuz takes too long)
-    //clock_gettime(CLOCK_MONOTONIC, &tstart);
-    //for (i = 0; i < n; i++) {
-    //    int find = randInt(0, cl->n);
-    //    cl_linear_find(cl, find);
-    //}
-    //clock_gettime(CLOCK_MONOTONIC, &tend);
-    //seconds = ((double)tend.tv_sec + 1.0e-9*tend.tv_nsec) - ((double)tstart.tv_sec + 1.0e-9*tstart.tv_nsec);
-    //printf("\tlinear finding %d items took about %.5f seconds\n", n, seconds);
-
     int count = 0;
+    int id;
+    for (id = 0; id <= cl->maxid; id++)
+        count += cl->items[id] != NULL;
 
-    community_list_item* cli = cl->first;
-    while (cli != NULL) {
-        cli = cli->next;
-        count++;
-    }
-
-    printf("\tcounted %d cli(n=%d)\n", count, cl->n);
-
-    count = 0;
-    skip_list_item* sli = cl->skip_list->first;
-    while (sli != NULL) {
-        sli = sli->next;
-        count++;
-    }
-
-    printf("\tcounted %d sli(n=%d)\n", count, cl->skip_list->n);
+    printf("\tcounted %d live ids (n=%d)\n", count, cl->n);
 }
 
 void cl_check_integrity(community_list* cl) {
-    community_list_item* current = cl->first;
-    int lastid = -1;
-
-    while(current != NULL) {
-        if (current->sl_item != NULL) {
-            if (current->sl_item->item != current) {
-                printf("ERROR: cli %d is pointing to sli %d\n", current->item->id, current->sl_item->maxid);
-            }
-        }
+    int count = 0;
+    int id;
+    for (id = 0; id <= cl->maxid; id++) {
+        community* c = cl->items[id];
+        if (c == NULL)
+            continue;
+        count++;
 
-        if (current->item->id < lastid) {
-            printf("ERROR: sorted order is broken at cli %d, last is %d\n", current->item->id, lastid);
-        } else {
-            lastid = current->item->id;
+        if (c->id != id) {
+            printf("ERROR: slot %d holds community %d\n", id, c->id);
         }
-
-        current = current->next;
     }
 
-    skip_list_item* prev_sli = cl->skip_list->first;
-    skip_list_item* current_sli = prev_sli;
-    while (current_sli != NULL) {
-        if (current_sli->item->item->id > current_sli->maxid) {
-            printf("ERROR: sli maxid=%d points to cli id=%d\n", current_sli->maxid, current_sli->item->item->id);
-        }
-
-        if (current_sli->maxid <= prev_sli->maxid && current_sli != prev_sli) {
-            printf("ERROR: maxid sorted order broken at sli %d (prev: %d)\n", current_sli->maxid, prev_sli->maxid);
-        }
-
-        if (current_sli->item->item->id <= prev_sli->item->item->id && current_sli != prev_sli) {
-            printf("ERROR: cli pointer sorted order broken at sli %d (prev: %d)\n", current_sli->item->item->id, prev_sli->item->item->id);
-        }
-
-        prev_sli = current_sli;
-        current_sli = current_sli->next;
+    if (count != cl->n) {
+        printf("ERROR: counted %d communities, n=%d\n", count, cl->n);
     }
-
-    fflush(stdout);
 }
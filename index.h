@@ -6,31 +6,15 @@
 #define MPICOMM_INDEX_H
 #include "graph.h"
 
-typedef struct community_list_item {
-    struct community_list_item* next;
-    struct skip_list_item* sl_item;
-    community* item;
-} community_list_item;
-
+// Live communities by id. Ids are handed out densely and in increasing order (see currentCommunityId), so the list is
+// a table indexed by id with O(1) find, remove and append. Removed ids keep a NULL slot
 typedef struct community_list {
-    struct community_list_item* first;
-    struct community_list_item* last;
-    struct skip_list* skip_list;
-    int n;
+    community** items; // items[id] is the live community with that id, or NULL
+    int capacity;      // length of items
+    int maxid;         // highest id in the list so far, -1 if none
+    int n;             // number of live communities
 } community_list;
 
-typedef struct skip_list_item {
-    struct skip_list_item* next;
-    int maxid;
-    community_list_item* item;
-} skip_list_item;
-
-typedef struct skip_list {
-    struct skip_list_item* first;
-    struct skip_list_item* last;
-    int n;
-} skip_list;
-
 typedef struct {
     graph *g;
     int n; // length of lengths[] and communities[]
@@ -41,9 +25,39 @@ typedef struct {
     // and communities[i][j] is the j-th community* containing node i
     // and len(communities[i]) = lengths[i]
 
-    community_list* list; // Linked list of community* sorted by id
+    community_list* list; // live communities by id
+
+    // Union-find over community ids. Each set holds the ids merged into one live community, so the communities in the
+    // inverse index, which are the initial ones, resolve to what they were merged into in near-constant time. See
+    // index_resolve
+    int* uf_parent;        // uf_parent[id] is the next id towards the set's root, or id itself for a root
+    int* uf_size;          // uf_size[root] is the number of ids in the set
+    community** uf_live;   // uf_live[root] is the live community the set was merged into
+    int uf_capacity;
+
+    int* stale_hits; // stale_hits[i] = sampled pairs at node i that resolved to the same community, see index_stale_hit
+
+    // if loaded via index_create_binary, the read-only file mapping that the initial communities' nodes point into
+    void* mapping;
+    size_t mapping_size;
 } c_index;
 
+// Binary community file layout: cnl_header, offsets (count + 1 ints), nodes (total ints), all in host byte order.
+// Community i's sorted, 0-indexed nodes are nodes[offsets[i] : offsets[i + 1]]
+#define CNL_MAGIC 0x424c4e43 // "CNLB" in little endian
+#define CNL_VERSION 1
+
+typedef struct {
+    int magic;
+    int version;
+    int count; // number of communities
+    int total; // sum of all community sizes, i.e. length of nodes
+} cnl_header;
+
+// index_compact_node drops a node's duplicate entries once more than this fraction of them are stale, i.e. resolve to a
+// community another entry resolves to as well
+#define INDEX_STALE_RATIO 0.5
+
 // in main.c
 extern int world_rank;
 
@@ -51,31 +65,42 @@ community_list* cl_new();
 
 c_index *index_create(char *filename, graph *g);
 
+c_index *index_create_nl(char *filename, graph *g);
+
+c_index *index_create_binary(char *filename, graph *g);
+
+int index_write_binary(char *nl_filename, char *out_filename);
+
+void index_free_nodes(c_index *ind, community *c);
+
 void index_print(c_index *ind);
 
 void index_update(c_index *ind, community *a, community *b, community *merged);
 
+// The live community that c, or the community it was merged into, was merged into since
+community *index_resolve(c_index *ind, community *c);
+
+// Replaces node's entries by the live communities they resolve to, and if enough of them are stale, keeps only one
+// entry per live community. Returns 1 if the list was compacted
+int index_compact_node(c_index *ind, int node);
+
+// Records that two entries of node's list were sampled and resolved to the same community. Once that happened for a
+// quarter of the list's length, the list is checked with index_compact_node, so checks cost O(log length) per hit
+void index_stale_hit(c_index *ind, int node);
+
 void cl_remove(community_list* list, int id);
 
 void cl_append(community_list* list, community* community);
 
 void cl_insert(community_list* list, community* community);
 
-community* cl_linear_find(community_list* list, int id);
-
 community* cl_find(community_list* list, int id);
 
-community_list_item* cl_find_nearest_leq(community_list* list, int id);
-
 void cl_print(community_list* cl);
 
-skip_list* sl_new(community_list_item* c);
-
-skip_list_item* sl_new_item(community_list_item* c);
-
-void sl_rebuild(community_list* list);
+void cl_write(community_list* cl, FILE* f, int* original_ids);
 
-void sl_print(skip_list * sl);
+int* index_read_nodemap(char* filename, int n);
 
 void index_print_meta();
 
@@ -5,10 +5,24 @@
 #include "lib.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <lapacke.h>
 #include <math.h>
 #include <time.h>
 
+#if EV_DOUBLE
+#define syevx_work LAPACKE_dsyevx_work
+#define sbevx_work LAPACKE_dsbevx_work
+#else
+#define syevx_work LAPACKE_ssyevx_work
+#define sbevx_work LAPACKE_ssbevx_work
+#endif
+
+double ev_tolerance = 0;
+
+void setEvTolerance(double minEvDelta) {
+    ev_tolerance = EV_TOLERANCE * minEvDelta;
+}
 
 void printMatrix(matrix *mat) {
     int i, j;
@@ -40,81 +54,229 @@ float secondSmallest(float array[], int n) {
     return min2;
 }
 
+ev_workspace *evWorkspaceNew(int capacity) {
+    ev_workspace *ws = malloc(sizeof(ev_workspace));
+    ws->capacity = capacity;
+    ws->adjacency = malloc((size_t) capacity * capacity * sizeof(ev_real));
+    ws->laplacian = malloc((size_t) capacity * capacity * sizeof(ev_real));
+    ws->row_sums = malloc(capacity * sizeof(ev_real));
+    ws->eigenvalues = malloc(capacity * sizeof(ev_real));
+    ws->iwork = malloc(5 * capacity * sizeof(int));
+    ws->ifail = malloc(capacity * sizeof(int));
+    ws->order = malloc(capacity * sizeof(int));
+    ws->position = malloc(capacity * sizeof(int));
+
+    // workspace query: lwork = -1 makes ssyevx only report the optimal size in work[0]. That grows with n, so the
+    // size for capacity covers all smaller matrices
+    ev_real optimal = 0;
+    lapack_int m;
+    syevx_work(LAPACK_COL_MAJOR, 'N', 'I', 'U', capacity, ws->laplacian, capacity, 0, 0, 2, 2, 0, &m,
+               ws->eigenvalues, NULL, capacity, &optimal, -1, ws->iwork, ws->ifail);
+    ws->lwork = (int) optimal > 8 * capacity ? (int) optimal : 8 * capacity; // ssbevx takes 7 x n
+    ws->work = malloc(ws->lwork * sizeof(ev_real));
+
+    return ws;
+}
+
+void evWorkspaceFree(ev_workspace *ws) {
+    free(ws->adjacency);
+    free(ws->laplacian);
+    free(ws->row_sums);
+    free(ws->eigenvalues);
+    free(ws->work);
+    free(ws->iwork);
+    free(ws->ifail);
+    free(ws->order);
+    free(ws->position);
+    free(ws);
+}
+
 // overrides matrix!
 float secondSmallestEv(matrix *mat) {
-    float *A = mat->rowmaj;
+    ev_workspace *ws = evWorkspaceNew(mat->n > 0 ? mat->n : 1);
+    float ev = secondSmallestEvWork(mat, ws, 0);
+    evWorkspaceFree(ws);
+    return ev;
+}
 
-    lapack_int info, n, lda, m, ifail;
+// overrides matrix!
+float secondSmallestEvWork(matrix *mat, ev_workspace *ws, double abstol) {
+    ev_real *A = mat->rowmaj;
+
+    lapack_int info, n, lda, m;
     n = mat->n;
     lda = mat->n; // leading dimension of A or sth
 
-    // eigenvalues are saved here (real and imaginary values)
-    float *wr = malloc(n * sizeof(float));
-    //float *wi = malloc(n * sizeof(float));
+    if (n < 2)
+        return 0;
+
+    // eigenvalues are saved here
+    ev_real *wr = ws->eigenvalues;
 
-    float range_from = 0;
-    float range_to = 0;
+    ev_real range_from = 0;
+    ev_real range_to = 0;
 
-    int index_from = 1;
+    // only lambda 2, bisection doesn't need to find lambda 1 for that
+    int index_from = 2;
     int index_to = 2;
 
-    float abstol = 0; // error tolerance - set depending on minEvDelta
+    // 'N' and 0 arguments are because we don't need eigenvectors. Bisection stops once lambda 2 is bracketed to within
+    // abstol, or machine precision if that is 0. The row major lower triangle is the column major upper one of the same
+    // symmetric matrix, and the row major wrapper would transpose A into a temporary on every call
+    info = syevx_work(LAPACK_COL_MAJOR, 'N', 'I', 'U', n, A, lda, range_from, range_to, index_from, index_to,
+                      abstol, &m, wr, NULL, lda, ws->work, ws->lwork, ws->iwork, ws->ifail);
+
+    if (info != 0) {
+        printf("ERROR FINDING EVS: info=%d\n", info);
+    }
+
+    return wr[0];
+}
 
-    // 'N' and 0 arguments are because we don't need eigenvectors
-    //info = LAPACKE_sgeev(LAPACK_ROW_MAJOR, 'N', 'N', n, A, lda, wr, wi, 0, lda, 0, lda);
-    info = LAPACKE_ssyevx(LAPACK_ROW_MAJOR, 'N', 'I', 'L', n, A, lda, range_from, range_to, index_from, index_to, abstol, &m, wr, 0, lda, &ifail);
+int bandOrder(matrix *mat, ev_real *degrees, int *order, int *position) {
+    int n = mat->n;
+    int i, j, k;
+    for (i = 0; i < n; i++)
+        position[i] = -1;
 
+    // Cuthill-McKee is a breadth first search that visits each node's neighbors by increasing degree. order doubles as
+    // the queue, and position marks the nodes already in it
+    int tail = 0;
+    while (tail < n) {
+        // each component starts from a node of minimum degree, which tends to be at its periphery
+        int start = -1;
+        for (i = 0; i < n; i++)
+            if (position[i] < 0 && (start < 0 || degrees[i] < degrees[start]))
+                start = i;
+        position[start] = tail;
+        order[tail++] = start;
+
+        int head;
+        for (head = tail - 1; head < tail; head++) {
+            int u = order[head];
+            int first = tail;
+            // u's row left of the diagonal, then its column below it
+            for (j = 0; j < n; j++) {
+                ev_real entry = j < u ? mat->rowmaj[u * n + j] : mat->rowmaj[j * n + u];
+                if (j != u && entry != 0 && position[j] < 0) {
+                    position[j] = tail;
+                    order[tail++] = j;
+                }
+            }
+
+            // insertion sort, communities are small and so are the numbers of new neighbors
+            for (i = first + 1; i < tail; i++) {
+                int v = order[i];
+                for (k = i; k > first && degrees[order[k - 1]] > degrees[v]; k--)
+                    order[k] = order[k - 1];
+                order[k] = v;
+            }
+        }
+    }
+
+    // reversing the order narrows the profile, the bandwidth stays the same
+    for (i = 0; i < n / 2; i++) {
+        int t = order[i];
+        order[i] = order[n - 1 - i];
+        order[n - 1 - i] = t;
+    }
+    for (i = 0; i < n; i++)
+        position[order[i]] = i;
+
+    int width = 0;
+    for (i = 0; i < n; i++)
+        for (j = 0; j < i; j++)
+            if (mat->rowmaj[i * n + j] != 0 && abs(position[i] - position[j]) > width)
+                width = abs(position[i] - position[j]);
+    return width;
+}
+
+// Lambda 2 of laplacian, with rows and columns permuted to ws->order, from its lower band of width kd. The band is
+// stored column major in ws->adjacency, column s holding entries (s, s) to (s + kd, s)
+static float bandLaplacianEv(matrix *laplacian, int kd, ev_workspace *ws, double abstol) {
+    int n = laplacian->n;
+    int ldab = kd + 1;
+    ev_real *band = ws->adjacency;
+    memset(band, 0, (size_t) ldab * n * sizeof(ev_real));
+
+    int i, j;
+    for (i = 0; i < n; i++) {
+        int r = ws->position[i];
+        for (j = 0; j <= i; j++) {
+            ev_real entry = laplacian->rowmaj[i * n + j];
+            if (entry == 0)
+                continue;
+            int s = ws->position[j];
+            int lo = r < s ? r : s;
+            band[abs(r - s) + lo * ldab] = entry;
+        }
+    }
+
+    lapack_int m;
+    lapack_int info = sbevx_work(LAPACK_COL_MAJOR, 'N', 'I', 'L', n, kd, band, ldab, NULL, 1, 0, 0, 2, 2, abstol,
+                                 &m, ws->eigenvalues, NULL, 1, ws->work, ws->iwork, ws->ifail);
     if (info != 0) {
         printf("ERROR FINDING EVS: info=%d\n", info);
     }
 
-    // print all evs?
-    //int i;
-    //printf("eigenvalues: ");
-    //for(i=0;i<mat->n;i++)
-    //    printf("%f ", wr[i]);
-    //printf("\nmin: %f\n", secondSmallest(wr, index_to - index_from + 1));
+    return ws->eigenvalues[0];
+}
 
-    float ret = wr[1];
-    free(wr);
-    return ret;
+float laplacianEvWork(matrix *laplacian, ev_real *degrees, ev_workspace *ws, double abstol) {
+    int n = laplacian->n;
+    if (n < 2)
+        return 0;
+
+    if (BANDED_EV) {
+        int kd = bandOrder(laplacian, degrees, ws->order, ws->position);
+        if (kd * BANDED_EV_RATIO <= n)
+            return bandLaplacianEv(laplacian, kd, ws, abstol);
+    }
+
+    return secondSmallestEvWork(laplacian, ws, abstol);
 }
 
 // caller frees!
 matrix *toLaplacian(matrix *mat) {
     matrix *laplacian = malloc(sizeof(matrix));
     laplacian->n = mat->n;
-    laplacian->rowmaj = calloc(mat->n * mat->n, sizeof(float)); // malloc would be fine too
+    laplacian->rowmaj = malloc(mat->n * mat->n * sizeof(ev_real));
+
+    ev_real *row_sums = malloc((mat->n > 0 ? mat->n : 1) * sizeof(ev_real));
+    toLaplacianInto(mat, laplacian, row_sums);
+    free(row_sums);
+
+    return laplacian;
+}
 
+void toLaplacianInto(matrix *mat, matrix *laplacian, ev_real *row_sums) {
     // Cache sums of rows
-    float rowSums[mat->n];
     int i;
     for (i = 0; i < mat->n; i++) {
-        rowSums[i] = sumRow(mat, i);
+        row_sums[i] = sumRow(mat, i);
     }
 
+    // only the lower triangle is read by ssyevx, but the upper one is cleared too since laplacian may be reused
     int j;
     for (i = 0; i < mat->n; i++)
-        for (j = 0; j <= i; j++) {
-            float laplacian_value = 0;
-            if (i == j && rowSums[i] != 0) {
+        for (j = 0; j < mat->n; j++) {
+            ev_real laplacian_value = 0;
+            if (i == j && row_sums[i] != 0) {
                 laplacian_value = 1;
-            } else if (mat->rowmaj[mat->n * i + j]) {
-                laplacian_value = -1.0 / sqrt(rowSums[i] * rowSums[j]);
+            } else if (j < i && mat->rowmaj[mat->n * i + j]) {
+                laplacian_value = -1.0 / sqrt(row_sums[i] * row_sums[j]);
             }
             laplacian->rowmaj[mat->n * i + j] = laplacian_value;
         }
-
-    return laplacian;
 }
 
-float sumRow(matrix *mat, int row) {
+ev_real sumRow(matrix *mat, int row) {
     if (row < 0 || row > mat->n) {
         printf("bad argument row (%d) passed to sumRow", row);
         return 0;
     }
 
-    float c = 0;
+    ev_real c = 0;
     int i;
     for (i = 0; i < mat->n; i++)
         c += mat->rowmaj[row * mat->n + i];
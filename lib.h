@@ -5,20 +5,89 @@
 #ifndef MPICOMM_LIB_H
 #define MPICOMM_LIB_H
 
+// Precision of the dense eigen path. EV_DOUBLE builds solve in double with dsyevx instead of ssyevx, which matters once
+// EV_TOLERANCE asks for more than float can resolve
+#ifndef EV_DOUBLE
+#define EV_DOUBLE 0
+#endif
+
+#if EV_DOUBLE
+typedef double ev_real;
+#else
+typedef float ev_real;
+#endif
+
+// Solves only need lambda 2 to within this fraction of minEvDelta, since that is the resolution of the merge decision.
+// Decisions closer to the boundary than the tolerance are solved again at full precision. 0 always solves at full
+// precision
+#ifndef EV_TOLERANCE
+#define EV_TOLERANCE 0.1
+#endif
+
+// absolute error allowed in lambda 2, set from minEvDelta by setEvTolerance. 0 means full precision
+extern double ev_tolerance;
+
+void setEvTolerance(double minEvDelta);
+
+// Reorder community subgraphs with reverse Cuthill-McKee, and if that leaves all edges within a band of at most
+// n / BANDED_EV_RATIO off the diagonal, find lambda 2 with the band solver ssbevx on packed band storage. Reducing the
+// band to tridiagonal form takes O(n^2 kd) instead of O(n^3) for the full matrix. Chain-like communities have narrow
+// bands, dense ones don't and keep the full solver
+#ifndef BANDED_EV
+#define BANDED_EV 1
+#endif
+
+#define BANDED_EV_RATIO 4
 
 typedef struct {
     int n; // a *square* matrix
-    float *rowmaj;
+    ev_real *rowmaj;
 } matrix;
 
+// Buffers for computing the eigenvalues of matrices of up to capacity x capacity, allocated once per worker so the
+// dense eigen path doesn't allocate anything. The ssyevx workspace size is queried once for the capacity
+typedef struct {
+    int capacity;
+    ev_real *adjacency;   // capacity x capacity, also the band of the band path
+    ev_real *laplacian;   // capacity x capacity
+    ev_real *row_sums;    // capacity
+    ev_real *eigenvalues; // capacity
+    ev_real *work;
+    int lwork;
+    int *iwork;           // 5 x capacity
+    int *ifail;           // capacity
+    int *order;           // capacity, the reverse Cuthill-McKee order of the band path
+    int *position;        // capacity, position[i] is node i's index in order
+} ev_workspace;
+
+ev_workspace *evWorkspaceNew(int capacity);
+
+void evWorkspaceFree(ev_workspace *ws);
+
 // find second smallest value in a double array
 float secondSmallest(float array[], int n);
 
 float secondSmallestEv(matrix *mat);
 
+// secondSmallestEv using ws, which must fit mat, to within abstol. 0 is full precision
+float secondSmallestEvWork(matrix *mat, ev_workspace *ws, double abstol);
+
+// Reverse Cuthill-McKee order of the graph whose edges are the nonzeros of the lower triangle of mat, off the diagonal,
+// with the given node degrees. Writes the order and each node's position in it, and returns the bandwidth of mat in
+// that order
+int bandOrder(matrix *mat, ev_real *degrees, int *order, int *position);
+
+// Lambda 2 of laplacian, of which only the lower triangle is read, to within abstol. Goes through the band solver if
+// BANDED_EV and the band is narrow enough in the order degrees give, else secondSmallestEvWork, which overrides
+// laplacian. ws must fit it
+float laplacianEvWork(matrix *laplacian, ev_real *degrees, ev_workspace *ws, double abstol);
+
 matrix *toLaplacian(matrix *mat);
 
-float sumRow(matrix *mat, int row);
+// writes mat's Laplacian to laplacian, which must be of the same size. row_sums is scratch space for mat->n values
+void toLaplacianInto(matrix *mat, matrix *laplacian, ev_real *row_sums);
+
+ev_real sumRow(matrix *mat, int row);
 
 void printMatrix(matrix *mat);
 
@@ -1,26 +1,67 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <signal.h>
 #include <time.h>
+#include <math.h>
 #include <sys/time.h>
 #include <mpi.h>
 #include <execinfo.h>
 #include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "graph.h"
 #include "index.h"
 #include "main.h"
 #include "lib.h"
+#include "partition.h"
+#include "setops.h"
+#include "evcache.h"
+#include "spectral.h"
 
 #define TAG_TERMINATE 420
 #define TAG_UPDATE 69
 
 #define PRINT_RESULTS 0
 
+// load the graph once per host into an MPI shared memory window which all ranks on that host map,
+// instead of every rank holding a private copy
+#ifndef SHARED_GRAPH
+#define SHARED_GRAPH 1
+#endif
+
+// store the graph's adjacency as gap-encoded varints (see compressGraph), trading some decoding work for 3-4x less memory
+#ifndef COMPRESS_GRAPH
+#define COMPRESS_GRAPH 0
+#endif
+
+// split the graph's adjacency across the worker ranks instead of storing all of it on every host (see partition.h).
+// overrides SHARED_GRAPH and COMPRESS_GRAPH
+#ifndef PARTITION_GRAPH
+#define PARTITION_GRAPH 0
+#endif
+
+// Workers sample a batch of pairs at a time, check them on all OpenMP threads and send the merges they find in one
+// message, so a rank per socket or host does the work of a rank per core. Pairs per thread in a batch, more balances
+// the uneven cost of pairs better but leaves the batch working on older communities
+#ifndef PAIRS_PER_THREAD
+#define PAIRS_PER_THREAD 4
+#endif
+
+// most pairs in a batch, and so most updates in a message
+#define MAX_BATCH 256
+
 double minNodeOverlapPerc;
 double minDisjointEdgesPerc;
 double minEvDelta;
-int maxn = 400; // do not try to merge communities larger than this
+int maxn = 5000; // do not try to merge communities larger than this
+
+// tryMergeRandomPair samples nodes from [sample_from, sample_to). this is the rank's own block if PARTITION_GRAPH
+int sample_from = 0;
+int sample_to = 0;
 
 
 // Profiling
@@ -28,6 +69,9 @@ int npairs = 0; // number of pairs checked
 int nnodes = 0; // number of pairs passing node overlap
 int nedges = 0; // number of pairs passing edge overlap
 int nevs = 0;   // number of pairs passing ev improvement
+int nbound_rejects = 0; // number of pairs rejected by eigenvalue bounds, without solving
+int nbound_accepts = 0; // number of pairs accepted by eigenvalue bounds, without solving
+int nrefined = 0; // number of pairs solved again at full precision, because they were within ev_tolerance of the cutoff
 
 int nsent_updates = 0;
 int nreceived_updates = 0;
@@ -44,6 +88,23 @@ int world_rank;
 
 c_index *ind;
 
+// Node buffers checkPair splits candidate pairs into. Grown as needed and reused, so rejected pairs don't allocate
+typedef struct pair_scratch {
+  int *only1;  // c1 - c2
+  int *only2;  // c2 - c1
+  int *merged; // c1 union c2
+  int capacity;
+} pair_scratch;
+
+// checkPair's node buffers and node marks, one of each per thread. Created in prepare() once the graph is loaded
+int nthreads = 1;
+pair_scratch *scratch;
+edge_counter **counters;
+
+MPI_Datatype update_type; // merge_result as sent between master and workers
+
+MPI_Win graph_window = MPI_WIN_NULL; // backs the graph's arrays in SHARED_GRAPH mode
+
 time_t start_time;
 
 void sigsegv_handler(int sig) {
@@ -60,12 +121,11 @@ void sigsegv_handler(int sig) {
 }
 
 void sigintHandler(int sig_num) {
-  community_list_item* last = ind->list->last;
   if (world_rank == 0)
-    printf("%d: at %d, received %d, invalid %d, stale %d, merged %d\n", world_rank, last->item->id, nreceived_updates, ninvalid_updates, nstale_updates, nmerged_updates);
+    printf("%d: at %d, received %d, invalid %d, stale %d, merged %d\n", world_rank, ind->list->maxid, nreceived_updates, ninvalid_updates, nstale_updates, nmerged_updates);
   //cl_print(ind->list);
   else
-    printf("%d: at %d, sent %d, recvd %d\n", world_rank, last->item->id, nsent_updates, nreceived_updates);
+    printf("%d: at %d, sent %d, recvd %d, cached evs %ld, bounded %d, refined %d\n", world_rank, ind->list->maxid, nsent_updates, nreceived_updates, ev_cache_hits, nbound_rejects + nbound_accepts, nrefined);
 
   fflush(stdout);
 
@@ -82,15 +142,132 @@ void printDebug(char *format_string, ...) {
 #endif
 }
 
+// One rank per host loads the graph and copies its arrays (nodemap and edgelist, or coffsets and cedges
+// if COMPRESS_GRAPH) into a shared window, all other ranks on the host point their graph struct straight into that window.
+// The returned graph must not be passed to freeGraph, it lives until graph_window is freed.
+graph *loadSharedGraph(char *graphFile) {
+  MPI_Comm host_comm;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &host_comm);
+
+  int host_rank;
+  MPI_Comm_rank(host_comm, &host_rank);
+
+  graph *loaded = NULL;
+  long long sizes[3]; // n, e, compressed bytes (0 if not compressed)
+
+  if (host_rank == 0) {
+    loaded = loadGraph(graphFile);
+    if (COMPRESS_GRAPH)
+      compressGraph(loaded);
+    sizes[0] = loaded->n;
+    sizes[1] = loaded->e;
+    sizes[2] = loaded->cedges != NULL ? loaded->coffsets[loaded->n] : 0;
+  }
+
+  MPI_Bcast(sizes, 3, MPI_LONG_LONG, 0, host_comm);
+
+  graph *g = malloc(sizeof(graph));
+  g->n = sizes[0];
+  g->e = sizes[1];
+  g->mapping = NULL;
+  g->mapping_size = 0;
+  g->rows = NULL;
+  g->fetch = NULL;
+  g->part = NULL;
+
+  int compressed = sizes[2] > 0;
+  MPI_Aint first_bytes = compressed ? sizeof(size_t) * ((MPI_Aint) g->n + 1) : sizeof(int) * ((MPI_Aint) g->n + 1);
+  MPI_Aint second_bytes = compressed ? (MPI_Aint) sizes[2] : (MPI_Aint) sizeof(int) * g->e;
+
+  // only the loading rank contributes memory to the window, everyone else asks where it is
+  char *base;
+  MPI_Win_allocate_shared(host_rank == 0 ? first_bytes + second_bytes : 0, 1, MPI_INFO_NULL, host_comm, &base, &graph_window);
+
+  if (host_rank != 0) {
+    MPI_Aint size;
+    int disp_unit;
+    MPI_Win_shared_query(graph_window, 0, &size, &disp_unit, &base);
+  }
+
+  if (compressed) {
+    g->coffsets = (size_t *) base;
+    g->cedges = (unsigned char *) base + first_bytes;
+    g->nodemap = NULL;
+    g->edgelist = NULL;
+  } else {
+    g->nodemap = (int *) base;
+    g->edgelist = (int *) (base + first_bytes);
+    g->coffsets = NULL;
+    g->cedges = NULL;
+  }
+
+  MPI_Win_fence(0, graph_window);
+
+  if (host_rank == 0) {
+    memcpy(base, compressed ? (void *) loaded->coffsets : (void *) loaded->nodemap, first_bytes);
+    memcpy(base + first_bytes, compressed ? (void *) loaded->cedges : (void *) loaded->edgelist, second_bytes);
+    freeGraph(loaded);
+  }
+
+  // make the copy visible to the other ranks on this host before anyone reads it
+  MPI_Win_fence(0, graph_window);
+
+  MPI_Comm_free(&host_comm);
+
+  return g;
+}
+
+MPI_Datatype createUpdateType() {
+  int lengths[3] = {1, 1, 1};
+  MPI_Aint offsets[3] = {offsetof(merge_result, id1), offsetof(merge_result, id2), offsetof(merge_result, ev)};
+  MPI_Datatype types[3] = {MPI_INT, MPI_INT, MPI_FLOAT};
+
+  MPI_Datatype type;
+  MPI_Type_create_struct(3, lengths, offsets, types, &type);
+  MPI_Type_commit(&type);
+  return type;
+}
+
 c_index *prepare(char *graphFile, char *communitiesFile) {
-  FILE *fb = fopen(graphFile, "r");
-  graph *g = fromMetis(fb);
+  graph *g;
+  if (PARTITION_GRAPH) {
+    g = loadPartitionedGraph(graphFile);
+  } else if (SHARED_GRAPH) {
+    g = loadSharedGraph(graphFile);
+  } else {
+    g = loadGraph(graphFile);
+    if (COMPRESS_GRAPH)
+      compressGraph(g);
+  }
   printDebug("n: %d, e: %d\n", g->n, g->e);
-  printDebug("last edge: %d\n", g->edgelist[g->e - 1]);
   puts(graphFile);
 
   ind = index_create(communitiesFile, g);
 
+#ifdef _OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  // also picks the set kernels, before the threads checking pairs would
+  printDebug("%d threads, %s set kernels\n", nthreads, setopsKernels());
+  scratch = calloc(nthreads, sizeof(pair_scratch));
+  counters = malloc(nthreads * sizeof(edge_counter *));
+  int i;
+  for (i = 0; i < nthreads; i++)
+    counters[i] = edgeCounterNew(g);
+
+  sample_from = 0;
+  sample_to = g->n;
+
+  if (PARTITION_GRAPH && world_rank != 0) {
+    partition *p = g->part;
+    if (p->first < p->last) { // more workers than nodes leaves some without a block
+      sample_from = p->first;
+      sample_to = p->last;
+    }
+    prefetchHalo(ind);
+    printDebug("%d: owns nodes %d to %d, prefetched %d rows\n", world_rank, p->first, p->last, p->nfetched);
+  }
+
   return ind;
 }
 
@@ -98,46 +275,87 @@ void setParams(double pminNodeOverlapPerc, double pminDisjointEdgesPerc, double
   minNodeOverlapPerc = pminNodeOverlapPerc;
   minDisjointEdgesPerc = pminDisjointEdgesPerc;
   minEvDelta = pminEvDelta;
+  setEvTolerance(minEvDelta);
+}
+
+// A worker only applies its own merges once the master sends them back, so it holds on to the Fiedler vectors of the
+// merges it found until then, to hand them to the merged community (see spectral.h)
+#define PENDING_FIEDLERS (2 * MAX_BATCH)
+
+typedef struct {
+  int id1;
+  int id2;
+  float *fiedler;
+} pending_fiedler;
+
+pending_fiedler pending[PENDING_FIEDLERS];
+int next_pending = 0;
+
+void keepFiedler(merge_result *update, community *result) {
+  pending_fiedler *p = &pending[next_pending];
+  next_pending = (next_pending + 1) % PENDING_FIEDLERS;
+
+  free(p->fiedler); // the master probably dropped that update as stale
+  p->id1 = update->id1;
+  p->id2 = update->id2;
+  p->fiedler = result->fiedler;
+  result->fiedler = NULL;
+}
+
+// the kept Fiedler vector of the merge in update, or NULL
+float *takeFiedler(merge_result *update) {
+  int i;
+  for (i = 0; i < PENDING_FIEDLERS; i++) {
+    pending_fiedler *p = &pending[i];
+    if (p->fiedler != NULL && p->id1 == update->id1 && p->id2 == update->id2) {
+      float *fiedler = p->fiedler;
+      p->fiedler = NULL;
+      return fiedler;
+    }
+  }
+  return NULL;
 }
 
 int tries = 0;
 
-merge_result tryMergeRandomPair(c_index *ind) {
+// Find a random node that is in at least two communities and select two random and distinct communities from those,
+// or rather the communities they were merged into since
+void samplePair(c_index *ind, community **pc1, community **pc2) {
   community *c1;
   community *c2;
 
   int node;
 
-  merge_result ret;
-  ret.id1 = -1;
-  ret.id2 = -1;
-
-  // Find a random node that is in at least two communities
-  // and select two random and distinct communities from those
   do {
-    node = randInt(0, ind->n);
+    node = randInt(sample_from, sample_to);
 
     if (ind->lengths[node] < 2)
       continue;
 
     int c1index = randInt(0, ind->lengths[node]);
     int c2index = randInt(0, ind->lengths[node]);
-    c1 = ind->communities[node][c1index];
-    c2 = ind->communities[node][c2index];
+    c1 = index_resolve(ind, ind->communities[node][c1index]);
+    c2 = index_resolve(ind, ind->communities[node][c2index]);
+
+    // duplicates pile up in the lists of nodes in communities that merged, see index_compact_node
+    if (c1 == c2 && c1index != c2index)
+      index_stale_hit(ind, node);
 
     //if (c1->id != c2->id)
     //    printDebug("Comparing @ node %5d: %5d v %5d", node, c1index, c2index);
 
-  } while (ind->lengths[node] < 2 || c1->id == c2->id || c1->n > maxn || c2->n > maxn);
+  } while (ind->lengths[node] < 2 || c1 == c2 || c1->n > maxn || c2->n > maxn);
 
-  while (c1->parent != NULL)
-    c1 = c1->parent;
-  while (c2->parent != NULL)
-    c2 = c2->parent;
+  *pc1 = c1;
+  *pc2 = c2;
+}
 
-  pairs_since_success++;
-  tries++;
-  community *result = checkPair(ind->g, c1, c2);
+// The update for checkPair's result on c1 and c2, which is consumed. id1 is -1 if the pair isn't merged
+merge_result pairResult(community *c1, community *c2, community *result) {
+  merge_result ret;
+  ret.id1 = -1;
+  ret.id2 = -1;
+  ret.ev = 0;
 
   if (result) {
     if (PRINT_RESULTS) {
@@ -150,15 +368,20 @@ merge_result tryMergeRandomPair(c_index *ind) {
       int n2 = c2->n;
       //index_update(ind, c1, c2, result);
       char* embedded = (result->n == n1 || result->n == n2) ? "(embedded)" : "";
-      printf("pairs %10d | node pass %10d | edge pass %10d | time %5d | id1 %8d | id2 %8d | newid %8d | evs: %1.5f (%2d) / %1.5f (%2d) -> %1.5f (%2d) %s\n",
-          pairs_since_success, nnodes, nedges, t, id1, id2, result->id, ev1, n1, ev2, n2, result->ev, result->n, embedded);
+      printf("pairs %10d | node pass %10d | edge pass %10d | bounded %10d | time %5ld | id1 %8d | id2 %8d | newid %8d | evs: %1.5f (%2d) / %1.5f (%2d) -> %1.5f (%2d) %s\n",
+          pairs_since_success, nnodes, nedges, nbound_rejects + nbound_accepts, (long) t, id1, id2, result->id, ev1, n1, ev2, n2, result->ev, result->n, embedded);
       pairs_since_success = 0;
       nnodes = 0;
       nedges = 0;
+      nbound_rejects = 0;
+      nbound_accepts = 0;
     }
 
     ret.id1 = c1->id;
     ret.id2 = c2->id;
+    ret.ev = result->ev;
+    if (WARM_START_FIEDLER && result->fiedler != NULL)
+      keepFiedler(&ret, result);
   }
 
 #ifdef DEBUG
@@ -166,70 +389,222 @@ merge_result tryMergeRandomPair(c_index *ind) {
   communityIsMessedUp(c2);
 #endif
 
-  free(result);
+  freeCommunity(result);
 
   return ret;
 }
 
+merge_result tryMergeRandomPair(c_index *ind) {
+  community *c1;
+  community *c2;
+  samplePair(ind, &c1, &c2);
+
+  pairs_since_success++;
+  tries++;
+  community *result = checkPair(ind->g, c1, c2);
+
+  return pairResult(c1, c2, result);
+}
+
+// 1 if c is one of the n communities in batch
+int inBatch(community **batch, int n, community *c) {
+  int i;
+  for (i = 0; i < n; i++)
+    if (batch[i] == c)
+      return 1;
+  return 0;
+}
+
+// tryMergeRandomPair for a batch of pairs, checked in parallel. Writes the merges found to updates and returns how
+// many there are. checkPair writes eigenvalues and Fiedler vectors to the pair's communities, so no community is in two
+// pairs of a batch. Partitioned graphs fetch rows with MPI calls from within checkPair, so their batches are checked
+// on one thread
+int tryMergeRandomBatch(c_index *ind, merge_result *updates) {
+  community *pairs[2 * MAX_BATCH]; // pair i is pairs[2 * i] and pairs[2 * i + 1]
+  community *results[MAX_BATCH];
+
+  int size = nthreads * PAIRS_PER_THREAD < MAX_BATCH ? nthreads * PAIRS_PER_THREAD : MAX_BATCH;
+
+  // a few communities sharing all overlapping nodes can't fill a batch, so give up on that eventually
+  int n = 0;
+  int attempts;
+  for (attempts = 0; n < size && attempts < 4 * size; attempts++) {
+    community *c1;
+    community *c2;
+    samplePair(ind, &c1, &c2);
+    if (c1 == c2 || inBatch(pairs, 2 * n, c1) || inBatch(pairs, 2 * n, c2))
+      continue;
+
+    pairs[2 * n] = c1;
+    pairs[2 * n + 1] = c2;
+    n++;
+  }
+
+  pairs_since_success += n;
+  tries += n;
+
+  int i;
+#pragma omp parallel for schedule(dynamic, 1) if(!PARTITION_GRAPH)
+  for (i = 0; i < n; i++)
+    results[i] = checkPair(ind->g, pairs[2 * i], pairs[2 * i + 1]);
+
+  int found = 0;
+  for (i = 0; i < n; i++) {
+    merge_result update = pairResult(pairs[2 * i], pairs[2 * i + 1], results[i]);
+    if (update.id1 != -1)
+      updates[found++] = update;
+  }
+  return found;
+}
+
+void reserveScratch(pair_scratch *s, int n) {
+  if (n <= s->capacity)
+    return;
+
+  s->capacity = n * 2;
+  s->only1 = realloc(s->only1, s->capacity * sizeof(int));
+  s->only2 = realloc(s->only2, s->capacity * sizeof(int));
+  s->merged = realloc(s->merged, s->capacity * sizeof(int));
+}
+
+// a community living in one of the scratch buffers
+community scratchCommunity(int *nodes, int n) {
+  community c = {0, EV_UNKNOWN, n, nodes, NULL, NULL};
+  return c;
+}
+
+// heap copy of a scratch community, for pairs that get merged. Takes over its Fiedler vector
+community *keepCommunity(community *c, int id, float ev) {
+  community *kept = malloc(sizeof(community));
+  *kept = scratchCommunity(malloc(c->n * sizeof(int)), c->n);
+  memcpy(kept->nodes, c->nodes, c->n * sizeof(int));
+  kept->id = id;
+  kept->ev = ev;
+  kept->fiedler = c->fiedler;
+  c->fiedler = NULL;
+  return kept;
+}
+
+// Decides mergedEv - minEvDelta > largerEv from bounds on both eigenvalues if possible: 1 if it holds for sure, -1
+// if it can't hold, 0 if it takes a solve. An eigenvalue known from earlier or from another rank is its own bound, up
+// to the ev_tolerance it was solved with
+int boundPair(community *merged, community *larger, pair_edges *edges) {
+  float mergedLower = 0;
+  float mergedUpper = mergedEvUpperBound(merged, edges);
+  if (knownEv(merged)) {
+    mergedLower = merged->ev - ev_tolerance;
+    mergedUpper = merged->ev + ev_tolerance;
+  }
+
+  float largerLower = 0;
+  float largerUpper = evUpperBound(larger);
+  if (knownEv(larger)) {
+    largerLower = larger->ev - ev_tolerance;
+    largerUpper = larger->ev + ev_tolerance;
+  }
+
+  if (mergedUpper - minEvDelta <= largerLower) {
+#pragma omp atomic
+    nbound_rejects++;
+    return -1;
+  }
+  if (mergedLower - minEvDelta > largerUpper) {
+#pragma omp atomic
+    nbound_accepts++;
+    return 1;
+  }
+  return 0;
+}
+
 // Returns pointer to merged community if merge makes sense, else 0
 community *checkPair(graph *g, community *c1, community *c2) {
   community *ret = 0;
+#pragma omp atomic
   npairs++;
 
-  // Compute the number of overlapping nodes
-  int commonNodes = commonElements(c1, c2);
+  int thread = 0;
+#ifdef _OPENMP
+  thread = omp_get_thread_num();
+#endif
+  pair_scratch *s = &scratch[thread];
+
   int largerCommunitySize = c1->n > c2->n ? c1->n : c2->n;
   int minOverlappingNodes = largerCommunitySize * minNodeOverlapPerc;
+
+  // Compute the number of overlapping nodes with the SIMD or galloping kernels, most pairs are rejected on that alone
+  int commonNodes = commonElements(c1, c2);
   printDebug("\t%5d common nodes, larger has %5d => cutoff = %5d", commonNodes, largerCommunitySize, minOverlappingNodes);
 
+  if (commonNodes <= minOverlappingNodes && commonNodes != c1->n && commonNodes != c2->n) {
+    printDebug("\n");
+    return ret;
+  }
+
+  // only then split the pair into its disjoint parts and union in one pass
+  int n1, n2;
+  reserveScratch(s, c1->n + c2->n);
+  splitPair(c1->nodes, c1->n, c2->nodes, c2->n, -1, s->only1, &n1, s->only2, &n2, s->merged);
+
+  community merged = scratchCommunity(s->merged, c1->n + c2->n - commonNodes);
+
   // If that passes a threshold:
   if (commonNodes > minOverlappingNodes) {
+#pragma omp atomic
     nnodes++;
 
-    community *a = setMinus(c1, c2); // A is part of c1 that doesn't overlap with c2
-    community *c = setMinus(c2, c1); // C is part of c2 that doesn't overlap with c1
-    community *larger = a->n > c->n ? a : c;
+    community a = scratchCommunity(s->only1, n1); // A is part of c1 that doesn't overlap with c2
+    community c = scratchCommunity(s->only2, n2); // C is part of c2 that doesn't overlap with c1
 
-    int disjointEdges = edgesBetweenSubsets(g, a, c);
-    int innerEdges = edgesBetweenSubsets(g, larger, larger) / 2; // divide by two because this counts each edge twice
+    // edges between A and C, and edges within the larger of them
+    pair_edges edges;
+    countPairEdges(g, counters[thread], &a, &c, &merged, &edges);
+    int disjointEdges = edges.disjoint;
+    int innerEdges = edges.inner;
 
     printDebug(" PASS\t inner edges: %6d disjoint edges: %6d", innerEdges, disjointEdges);
 
     // If there are enough edges between the disjoint parts of c1 and c2:
     if (disjointEdges > minDisjointEdgesPerc * innerEdges) {
+#pragma omp atomic
       nedges++;
 
-      community *merged = merge(c1, c2);
-      larger = c1->n > c2->n ? c1 : c2;
+      community *larger = c1->n > c2->n ? c1 : c2;
 
-      // Find the second smallest eigenvalues
-      double mergedEv = communityEv(merged, g);
-      double largerEv = communityEv(larger, g);
+      // Many pairs are decided by bounds on the eigenvalues already
+      int decision = boundPair(&merged, larger, &edges);
+      if (decision != 0)
+        printDebug(" BOUNDED");
+
+      // Else find the second smallest eigenvalues,
+      // larger first, so its Fiedler vector is there to warm start the merged community's
+      double largerEv = decision == 0 ? communityEv(larger, g) : larger->ev;
+      double mergedEv = decision == 0 ? mergedCommunityEv(&merged, c1, c2, g) : merged.ev;
+
+      // Both are only solved to within ev_tolerance, so a difference that close to the cutoff could go either way
+      if (decision == 0 && fabs(mergedEv - minEvDelta - largerEv) <= 2 * ev_tolerance) {
+#pragma omp atomic
+        nrefined++;
+        largerEv = exactCommunityEv(larger, NULL, NULL, g);
+        mergedEv = exactCommunityEv(&merged, c1, c2, g);
+      }
 
       printDebug(" PASS mergedEv: %1.5f largerEv: %1.5f", mergedEv, largerEv);
 
       // If the eigenvalue improves
-      if (mergedEv - minEvDelta > largerEv) {
+      if (decision > 0 || (decision == 0 && mergedEv - minEvDelta > largerEv)) {
+#pragma omp atomic
         nevs++;
 
         printDebug(" PASS!");
-        ret = merged;
-
-      } else { // throw away
-        free(merged->nodes);
-        free(merged);
+        ret = keepCommunity(&merged, c1->id, merged.ev);
+      } else {
+        free(merged.fiedler);
       }
     }
 
-    free(a->nodes);
-    free(a);
-    free(c->nodes);
-    free(c);
-
   } else if (commonNodes == c1->n || commonNodes == c2->n) { // iff one community is embedded in the other,
     // we say the merge makes sense, since (TODO) we don't want embedded communities I guess
-    ret = merge(c1, c2);
-    ret->ev = commonNodes == c1->n ? c2->ev : c1->ev; // also set the ev
+    ret = keepCommunity(&merged, c1->id, commonNodes == c1->n ? c2->ev : c1->ev); // also set the ev
   }
 
   printDebug("\n");
@@ -240,9 +615,11 @@ community *checkPair(graph *g, community *c1, community *c2) {
 int main(int argc, char** argv) {
   setParams(0.1, 0.5, 0.001);
 
-  if (argc != 4) {
-    printf("usage: %s metis_graph communities_file timeout_seconds\n", argv[0]);
-    puts("IMPORTANT: remember to preprocess the input files using `preprocess.py file > newfile` (handles both .metis and .nl)");
+  if (argc < 4 || argc > 6) {
+    printf("usage: %s graph communities_file timeout_seconds [out_file [nodemap_file]]\n", argv[0]);
+    puts("IMPORTANT: remember to preprocess the input files using `preprocess graph.metis communities.nl min_size out_prefix`");
+    puts("graph may be a preprocessed .metis file or a binary graph written by `convert`, which loads much faster");
+    puts("if out_file is given, the merged communities are written there in .nl format, using the original node ids from nodemap_file (out_prefix.map)");
   }
 
   signal(SIGINT, sigintHandler);
@@ -255,8 +632,16 @@ int main(int argc, char** argv) {
   reset_clock();
 
   // Forms communicator, creates all MPI variables, etc...
-  // Args aren't necessary
-  MPI_Init(NULL, NULL);
+  // Args aren't necessary. Only the main thread makes MPI calls, the OpenMP threads just check pairs
+  int thread_support;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &thread_support);
+  if (thread_support < MPI_THREAD_FUNNELED) {
+    // the library doesn't allow other threads next to the one making MPI calls, so check batches serially
+    printf("MPI provides no MPI_THREAD_FUNNELED support, checking pairs on one thread\n");
+#ifdef _OPENMP
+    omp_set_num_threads(1);
+#endif
+  }
 
   int world_size;
   // Get size of communicator (= number of processes assigned)
@@ -276,6 +661,8 @@ int main(int argc, char** argv) {
 
   printf("hello from %d on %s\n", world_rank, processor_name);
 
+  update_type = createUpdateType();
+
   char *graphFile = argv[1];
   char *communitiesFile = argv[2];
 
@@ -303,7 +690,10 @@ int main(int argc, char** argv) {
   ////////////
 
   if (world_rank == 0) {
-    int update_ids[2];
+    merge_result updates[MAX_BATCH];
+    merge_result forward[MAX_BATCH]; // the received updates that are applied, in order
+    int nupdates;
+    int nforward;
 
     MPI_Status status;
 
@@ -314,42 +704,56 @@ int main(int argc, char** argv) {
     for (;;) {
 
       MPI_Recv(
-          &update_ids,
-          2,
-          MPI_INT,
+          updates,
+          MAX_BATCH,
+          update_type,
           MPI_ANY_SOURCE,
           TAG_UPDATE,
           MPI_COMM_WORLD,
           &status
           );
+      MPI_Get_count(&status, update_type, &nupdates);
+
+      nforward = 0;
+      int u;
+      for (u = 0; u < nupdates; u++) {
+        merge_result update = updates[u];
+        nreceived_updates++;
+
+        // IDK how but this happens sometimes...
+        if (update.id1 == -1 || update.id2 == -1) {
+          ninvalid_updates++;
+          continue;
+        }
 
-      nreceived_updates++;
-
-      // IDK how but this happens sometimes...
-      if (update_ids[0] == -1 || update_ids[1] == -1) {
-        ninvalid_updates++;
-        continue;
-      }
+        c1 = cl_find(ind->list, update.id1);
+        c2 = cl_find(ind->list, update.id2);
 
-      // TODO: Optimization. Don't keep a full community list. Just an int array which tracks merges.
-      c1 = cl_find(ind->list, update_ids[0]);
-      c2 = cl_find(ind->list, update_ids[1]);
+        //printf("RECV update %d %d (from: %d)\n", update.id1, update.id2, status.MPI_SOURCE);
 
-      //printf("RECV update %d %d (from: %d)\n", update_ids[0], update_ids[1], status.MPI_SOURCE);
+        if (c1 == NULL || c2 == NULL) { // if c1 or c2 have been merged in the meanwhile, ignore the update
+          nstale_updates++;
+          continue;
+        }
 
-      if (c1 == NULL || c2 == NULL) { // if c1 or c2 have been merged in the meanwhile, ignore the update
-        nstale_updates++;
-        continue;
+        merged = merge(c1, c2);
+        merged->ev = update.ev;
+        index_update(ind, c1, c2, merged);
+        nmerged_updates++;
+        forward[nforward++] = update;
+        //if (nmerged_updates % 1000 == 0) {
+        //        printf("merged %d\n", nmerged_updates);
+        //}
       }
 
-      // Send id of merged pair to all.
+      // Send ids of merged pairs and their eigenvalues to all.
       // TODO: Optimization potential, use broadcasting algorithm.
       int i;
-      for (i = 1; i < world_size; i++) {
+      for (i = 1; i < world_size && nforward > 0; i++) {
         MPI_Send(
-            &update_ids,
-            2,
-            MPI_INT,
+            forward,
+            nforward,
+            update_type,
             i,
             TAG_UPDATE,
             MPI_COMM_WORLD//,
@@ -357,20 +761,13 @@ int main(int argc, char** argv) {
             );
       }
 
-      merged = merge(c1, c2);
-      index_update(ind, c1, c2, merged);
-      nmerged_updates++;
-      //if (nmerged_updates % 1000 == 0) {
-      //        printf("merged %d\n", nmerged_updates);
-      //}
-
       if ((unsigned long) time(NULL) - stime > atoi(argv[3])) {
         break;
       }
 
 
 
-      //printf("SENDALL update %d %d -> %d (at: %u)\n", update_ids[0], update_ids[1], c1->id, (unsigned long) time(NULL));
+      //printf("SENDALL update %d %d -> %d (at: %u)\n", update.id1, update.id2, c1->id, (unsigned long) time(NULL));
       //fflush(stdout);
     }
 #pragma clang diagnostic pop
@@ -379,9 +776,9 @@ int main(int argc, char** argv) {
     int i;
     for (i = 1; i < world_size; i++) {
       MPI_Isend(
-          &update_ids,
-          2,
-          MPI_INT,
+          updates,
+          1,
+          update_type,
           i,
           TAG_TERMINATE,
           MPI_COMM_WORLD,
@@ -394,8 +791,10 @@ int main(int argc, char** argv) {
   ////////////
 
   } else {
-    int found_update_ids[2] = {-1, -1};
-    int recvd_update_ids[2];
+    merge_result found_updates[MAX_BATCH];
+    merge_result recvd_updates[MAX_BATCH];
+    int nfound;
+    int nrecvd;
 
     int received_message;
     MPI_Request receive_request;
@@ -403,7 +802,7 @@ int main(int argc, char** argv) {
     int message_waiting = 0;
 
     int sent_message;
-    MPI_Request send_request = NULL;
+    MPI_Request send_request = MPI_REQUEST_NULL;
     MPI_Status send_status;
 
 #pragma clang diagnostic push
@@ -426,43 +825,50 @@ int main(int argc, char** argv) {
         //printf("%d:%s\t receiving a message\n", world_rank, processor_name);
 
         MPI_Recv(
-            &recvd_update_ids,
-            2,
-            MPI_INT,
+            recvd_updates,
+            MAX_BATCH,
+            update_type,
             0,
             MPI_ANY_TAG,
             MPI_COMM_WORLD,
             &receive_status
             );
+        MPI_Get_count(&receive_status, update_type, &nrecvd);
 
+        int u;
         switch (receive_status.MPI_TAG) {
           case TAG_UPDATE:
-            c1 = cl_find(ind->list, recvd_update_ids[0]);
-            c2 = cl_find(ind->list, recvd_update_ids[1]);
-
-            if (c1 == NULL) {
-              printf("%d about to die: got NULL for id %d\n", world_rank, recvd_update_ids[0]);
-              community_list_item* last = ind->list->last;
-              printf("stuck on %d\n", last->item->id);
-              fflush(stdout);
-            }
-
-            if (c2 == NULL) {
-              printf("%d about to die: got NULL for id %d\n", world_rank, recvd_update_ids[1]);
-              community_list_item* last = ind->list->last;
-              printf("stuck on %d\n", last->item->id);
-              fflush(stdout);
+            for (u = 0; u < nrecvd; u++) {
+              merge_result *recvd_update = &recvd_updates[u];
+              c1 = cl_find(ind->list, recvd_update->id1);
+              c2 = cl_find(ind->list, recvd_update->id2);
+
+              if (c1 == NULL) {
+                printf("%d about to die: got NULL for id %d\n", world_rank, recvd_update->id1);
+                printf("stuck on %d\n", ind->list->maxid);
+                fflush(stdout);
+              }
+
+              if (c2 == NULL) {
+                printf("%d about to die: got NULL for id %d\n", world_rank, recvd_update->id2);
+                printf("stuck on %d\n", ind->list->maxid);
+                fflush(stdout);
+              }
+
+              merged = merge(c1, c2);
+              merged->ev = recvd_update->ev;
+              merged->fiedler = takeFiedler(recvd_update);
+              if (!isnan(merged->ev)) // pairs accepted on bounds alone go out without their ev
+                evCacheStore(merged->nodes, merged->n, merged->ev);
+              nreceived_updates++;
+
+              index_update(ind, c1, c2, merged);
+
+              //printf("RECV update %d %d -> %d (rank: %d) (tries since last merge: %d)\n", recvd_update->id1, recvd_update->id2, c1->id, world_rank, tries);
+              //fflush(stdout);
+              tries = 0;
             }
 
-            merged = merge(c1, c2);
-            nreceived_updates++;
-
-            index_update(ind, c1, c2, merged);
-
-            //printf("RECV update %d %d -> %d (rank: %d) (tries since last merge: %d)\n", recvd_update_ids[0], recvd_update_ids[1], c1->id, world_rank, tries);
-            //fflush(stdout);
-            tries = 0;
-
             break;
 
           case TAG_TERMINATE:
@@ -473,14 +879,20 @@ int main(int argc, char** argv) {
         //printf("%d got waiting: %d\n", world_rank, message_waiting);
       }
 
-      merge_result result = tryMergeRandomPair(ind);
-      found_update_ids[0] = result.id1;
-      found_update_ids[1] = result.id2;
+      // the previous batch's updates may still be in the send buffer. Keep draining the master's forwards until
+      // they're out, the master may itself be blocked sending to this rank
+      MPI_Test(&send_request, &sent_message, &send_status);
+      if (!sent_message)
+        continue;
 
-      //printf("%d:%s\t update is %d/%d\n", world_rank, processor_name, result.id1, result.id2);
+      if (PARTITION_GRAPH)
+        trimRowCache(ind->g); // no rows are in use between batches
+      nfound = tryMergeRandomBatch(ind, found_updates);
 
-      if (found_update_ids[0] != -1) {
-        nsent_updates++;
+      //printf("%d:%s\t found %d updates\n", world_rank, processor_name, nfound);
+
+      if (nfound > 0) {
+        nsent_updates += nfound;
         unsigned long long mergetime = (unsigned long) time(NULL) - stime;
         if (mergetime > max_update_time) {
           max_update_time = mergetime;
@@ -488,21 +900,18 @@ int main(int argc, char** argv) {
           min_update_time = mergetime;
         }
         stime = (unsigned long) time(NULL);
-        //printf("SEND update %d %d (rank: %d at %d now)\n", found_update_ids[0], found_update_ids[1], world_rank, ind->list->last->item->id);
+        //printf("SEND %d updates (rank: %d at %d now)\n", nfound, world_rank, ind->list->maxid);
         //fflush(stdout);
 
-        //printf("%d:%s\t now sending update %d/%d\n", world_rank, processor_name, found_update_ids[0], found_update_ids[1]);
         MPI_Isend(
-            &found_update_ids,
-            2,
-            MPI_INT,
+            found_updates,
+            nfound,
+            update_type,
             0,
             TAG_UPDATE,
             MPI_COMM_WORLD,
             &send_request
             );
-
-        found_update_ids[0] = -1;
       }
 
       //MPI_Irecv(
@@ -573,28 +982,39 @@ int main(int argc, char** argv) {
 
   // Stop.
 exit:;
-     community_list_item* last = ind->list->last;
      if (world_rank == 0) {
-       printf("%d@%s: at %d, received %d, invalid %d, stale %d, merged %d\n", world_rank, processor_name, last->item->id, nreceived_updates, ninvalid_updates, nstale_updates, nmerged_updates);
+       printf("%d@%s: at %d, received %d, invalid %d, stale %d, merged %d\n", world_rank, processor_name, ind->list->maxid, nreceived_updates, ninvalid_updates, nstale_updates, nmerged_updates);
 
        stime = (unsigned long) time(NULL);
        while ((unsigned long) time(NULL) - stime < 600);
-       cl_print(ind->list);
+
+       if (argc > 4) {
+         int *original_ids = argc > 5 ? index_read_nodemap(argv[5], ind->n) : NULL;
+         FILE *out = fopen(argv[4], "w");
+         cl_write(ind->list, out, original_ids);
+         fclose(out);
+         free(original_ids);
+       } else {
+         cl_print(ind->list);
+       }
      } else {
-       //printf("%d@%s: at %d, sent %d, recvd %d, min %d, max %d\n", world_rank, processor_name, last->item->id, nsent_updates, nreceived_updates, min_update_time, max_update_time);
+       //printf("%d@%s: at %d, sent %d, recvd %d, min %d, max %d\n", world_rank, processor_name, ind->list->maxid, nsent_updates, nreceived_updates, min_update_time, max_update_time);
      }
 
      fflush(stdout);
-     MPI_Finalize();
 
-     //community_list_item* current = ind->list->first;
-     //int prev = -1;
-     //while (current != NULL) {
-     //    if (current->item->id != prev + 1)
-     //        printf("%d %d\n", world_rank, current->item->id);
-     //    prev = current->item->id;
-     //    current = current->next;
-     //}
+     int t;
+     for (t = 0; t < nthreads; t++)
+       edgeCounterFree(counters[t]);
+     MPI_Type_free(&update_type);
+
+     if (graph_window != MPI_WIN_NULL)
+       MPI_Win_free(&graph_window);
+
+     if (PARTITION_GRAPH)
+       freePartitionedGraph(ind->g);
+
+     MPI_Finalize();
 
      // TODO have master print final data
 
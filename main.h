@@ -5,15 +5,21 @@
 #ifndef MPICOMM_MAIN_H
 #define MPICOMM_MAIN_H
 
+// also the update workers send to the master and the master forwards to all workers, as arrays of up to MAX_BATCH
 typedef struct merge_result {
     int id1;
     int id2;
+    float ev; // eigenvalue of the merged community, so no rank has to compute it again
 } merge_result;
 
+graph *loadSharedGraph(char *graphFile);
+
 c_index *prepare(char *graphFile, char *communitiesFile);
 
 merge_result tryMergeRandomPair(c_index *ind);
 
+int tryMergeRandomBatch(c_index *ind, merge_result *updates);
+
 community *checkPair(graph *g, community *c1, community *c2);
 
 void setParams(double minNodeOverlapPerc, double minDisjointEdgesPerc, double minEvDelta);
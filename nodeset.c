@@ -0,0 +1,242 @@
+//
+// Hybrid array/bitmap node sets, see nodeset.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "nodeset.h"
+#include "setops.h"
+
+#define KEY(v) ((v) >> 16)
+#define LOW(v) ((v) & 0xffff)
+
+nodeset *nodesetBuild(const int *nodes, int n) {
+    nodeset *s = malloc(sizeof(nodeset));
+    s->nodes = nodes;
+    s->n = n;
+    s->ncontainers = 0;
+
+    // count distinct keys first, nodes are sorted so they're contiguous
+    int i;
+    for (i = 0; i < n; i++)
+        if (i == 0 || KEY(nodes[i]) != KEY(nodes[i - 1]))
+            s->ncontainers++;
+
+    s->containers = malloc(sizeof(container) * (s->ncontainers > 0 ? s->ncontainers : 1));
+
+    int c = -1;
+    for (i = 0; i < n; i++) {
+        if (i == 0 || KEY(nodes[i]) != KEY(nodes[i - 1])) {
+            c++;
+            s->containers[c].key = KEY(nodes[i]);
+            s->containers[c].start = i;
+            s->containers[c].count = 0;
+            s->containers[c].bitmap = NULL;
+        }
+        s->containers[c].count++;
+    }
+
+    for (c = 0; c < s->ncontainers; c++) {
+        container *ct = &s->containers[c];
+        if (ct->count < NODESET_BITMAP_MIN)
+            continue;
+
+        ct->bitmap = calloc(NODESET_BITMAP_WORDS, sizeof(unsigned long long));
+        for (i = ct->start; i < ct->start + ct->count; i++)
+            ct->bitmap[LOW(nodes[i]) >> 6] |= 1ULL << (nodes[i] & 63);
+    }
+
+    return s;
+}
+
+void nodesetFree(nodeset *s) {
+    if (s == NULL)
+        return;
+
+    int c;
+    for (c = 0; c < s->ncontainers; c++)
+        free(s->containers[c].bitmap);
+    free(s->containers);
+    free(s);
+}
+
+static container *findContainer(nodeset *s, int key) {
+    int lo = 0;
+    int hi = s->ncontainers - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (s->containers[mid].key < key)
+            lo = mid + 1;
+        else if (s->containers[mid].key > key)
+            hi = mid - 1;
+        else
+            return &s->containers[mid];
+    }
+    return NULL;
+}
+
+static inline int bitSet(const unsigned long long *bitmap, int v) {
+    return (bitmap[LOW(v) >> 6] >> (v & 63)) & 1;
+}
+
+int nodesetContains(nodeset *s, int v) {
+    container *ct = findContainer(s, KEY(v));
+    if (ct == NULL)
+        return 0;
+    if (ct->bitmap != NULL)
+        return bitSet(ct->bitmap, v);
+
+    const int *nodes = s->nodes + ct->start;
+    int lo = 0;
+    int hi = ct->count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (nodes[mid] < v)
+            lo = mid + 1;
+        else if (nodes[mid] > v)
+            hi = mid - 1;
+        else
+            return 1;
+    }
+    return 0;
+}
+
+// write the ids of all set bits of a container with the given key to out
+static int extractBits(const unsigned long long *words, int key, int *out) {
+    int written = 0;
+    int w;
+    for (w = 0; w < NODESET_BITMAP_WORDS; w++) {
+        unsigned long long x = words[w];
+        while (x != 0) {
+            out[written++] = (key << 16) | (w << 6) | __builtin_ctzll(x);
+            x &= x - 1;
+        }
+    }
+    return written;
+}
+
+// number of ids of the array slice whose bit is set
+static int countBits(const unsigned long long *bitmap, const int *nodes, int count) {
+    int matches = 0;
+    int i;
+    for (i = 0; i < count; i++)
+        matches += bitSet(bitmap, nodes[i]);
+    return matches;
+}
+
+int nodesetIntersectCount(nodeset *a, nodeset *b) {
+    int count = 0;
+    int i = 0, j = 0;
+
+    while (i < a->ncontainers && j < b->ncontainers) {
+        container *x = &a->containers[i];
+        container *y = &b->containers[j];
+
+        if (x->key < y->key) {
+            i++;
+        } else if (y->key < x->key) {
+            j++;
+        } else {
+            if (x->bitmap != NULL && y->bitmap != NULL) {
+                int w;
+                for (w = 0; w < NODESET_BITMAP_WORDS; w++)
+                    count += __builtin_popcountll(x->bitmap[w] & y->bitmap[w]);
+            } else if (x->bitmap != NULL) {
+                count += countBits(x->bitmap, b->nodes + y->start, y->count);
+            } else if (y->bitmap != NULL) {
+                count += countBits(y->bitmap, a->nodes + x->start, x->count);
+            } else {
+                count += intersectCount(a->nodes + x->start, x->count, b->nodes + y->start, y->count);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    return count;
+}
+
+int nodesetDifference(nodeset *a, nodeset *b, int *out) {
+    int written = 0;
+    int i, j = 0;
+
+    for (i = 0; i < a->ncontainers; i++) {
+        container *x = &a->containers[i];
+        const int *xnodes = a->nodes + x->start;
+
+        while (j < b->ncontainers && b->containers[j].key < x->key)
+            j++;
+
+        if (j == b->ncontainers || b->containers[j].key != x->key) { // nothing to subtract
+            memcpy(out + written, xnodes, sizeof(int) * x->count);
+            written += x->count;
+            continue;
+        }
+
+        container *y = &b->containers[j];
+
+        if (x->bitmap != NULL && y->bitmap != NULL) {
+            unsigned long long words[NODESET_BITMAP_WORDS];
+            int w;
+            for (w = 0; w < NODESET_BITMAP_WORDS; w++)
+                words[w] = x->bitmap[w] & ~y->bitmap[w];
+            written += extractBits(words, x->key, out + written);
+        } else if (y->bitmap != NULL) {
+            int k;
+            for (k = 0; k < x->count; k++)
+                if (!bitSet(y->bitmap, xnodes[k]))
+                    out[written++] = xnodes[k];
+        } else {
+            written += difference(xnodes, x->count, b->nodes + y->start, y->count, out + written);
+        }
+    }
+
+    return written;
+}
+
+int nodesetUnion(nodeset *a, nodeset *b, int *out) {
+    int written = 0;
+    int i = 0, j = 0;
+
+    while (i < a->ncontainers || j < b->ncontainers) {
+        container *x = i < a->ncontainers ? &a->containers[i] : NULL;
+        container *y = j < b->ncontainers ? &b->containers[j] : NULL;
+
+        if (y == NULL || (x != NULL && x->key < y->key)) {
+            memcpy(out + written, a->nodes + x->start, sizeof(int) * x->count);
+            written += x->count;
+            i++;
+        } else if (x == NULL || y->key < x->key) {
+            memcpy(out + written, b->nodes + y->start, sizeof(int) * y->count);
+            written += y->count;
+            j++;
+        } else {
+            const int *xnodes = a->nodes + x->start;
+            const int *ynodes = b->nodes + y->start;
+
+            if (x->bitmap != NULL || y->bitmap != NULL) {
+                // OR into a copy of whichever side has a bitmap, then set the other side's bits
+                unsigned long long words[NODESET_BITMAP_WORDS];
+                int w, k;
+                if (x->bitmap != NULL && y->bitmap != NULL) {
+                    for (w = 0; w < NODESET_BITMAP_WORDS; w++)
+                        words[w] = x->bitmap[w] | y->bitmap[w];
+                } else {
+                    container *dense = x->bitmap != NULL ? x : y;
+                    const int *sparse = x->bitmap != NULL ? ynodes : xnodes;
+                    int nsparse = x->bitmap != NULL ? y->count : x->count;
+                    memcpy(words, dense->bitmap, sizeof(words));
+                    for (k = 0; k < nsparse; k++)
+                        words[LOW(sparse[k]) >> 6] |= 1ULL << (sparse[k] & 63);
+                }
+                written += extractBits(words, x->key, out + written);
+            } else {
+                written += setUnionInto(xnodes, x->count, ynodes, y->count, out + written);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    return written;
+}
@@ -0,0 +1,46 @@
+//
+// Hybrid array/bitmap view of a large community's nodes.
+//
+
+#ifndef MPICOMM_NODESET_H
+#define MPICOMM_NODESET_H
+
+// communities with at least this many nodes get a nodeset (see communitySet in graph.c)
+#define NODESET_MIN_SIZE 256
+// a container holding at least this many of the 65536 ids in its range is also stored as a bitmap
+#define NODESET_BITMAP_MIN 4096
+#define NODESET_BITMAP_WORDS 1024
+
+// Like a roaring bitmap, node ids are grouped by their upper 16 bits. Each group (container) is a slice of the
+// community's sorted node array, and dense containers additionally get a bitmap over their 2^16 ids. That way
+// sparse ranges still use the SIMD/galloping array kernels while dense ranges are intersected, subtracted and
+// merged a word at a time, and membership tests are a bit test or a binary search within one container.
+typedef struct {
+    int key;   // upper 16 bits of the node ids in this container
+    int start; // the container's ids are nodes[start : start + count]
+    int count;
+    unsigned long long *bitmap; // NODESET_BITMAP_WORDS words if count >= NODESET_BITMAP_MIN, else NULL
+} container;
+
+typedef struct nodeset {
+    const int *nodes; // the community's nodes this was built from
+    int n;
+    int ncontainers;
+    container *containers;
+} nodeset;
+
+nodeset *nodesetBuild(const int *nodes, int n);
+
+void nodesetFree(nodeset *s);
+
+int nodesetContains(nodeset *s, int v);
+
+int nodesetIntersectCount(nodeset *a, nodeset *b);
+
+// a - b into out, which must have room for a->n ints
+int nodesetDifference(nodeset *a, nodeset *b, int *out);
+
+// a union b into out, which must have room for a->n + b->n ints
+int nodesetUnion(nodeset *a, nodeset *b, int *out);
+
+#endif //MPICOMM_NODESET_H
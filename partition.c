@@ -0,0 +1,259 @@
+//
+// Distributed graph storage, see partition.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "partition.h"
+
+static int compareInts(const void *a, const void *b) {
+    int x = *(const int *) a;
+    int y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+int nodeOwner(partition *p, int u) {
+    return 1 + u / p->block;
+}
+
+static int *fetchRow(graph *g, int u) {
+    prefetchRows(g, &u, 1);
+    return g->rows[u];
+}
+
+// reads count ints at offset ints behind the header of the binary graph f
+static void readInts(FILE *f, char *filename, int *out, long offset, int count) {
+    if (fseek(f, sizeof(csr_header) + sizeof(int) * offset, SEEK_SET) != 0
+        || fread(out, sizeof(int), count, f) != (size_t) count) {
+        printf("could not read %s, it is truncated or corrupt. exiting...\n", filename);
+        exit(1);
+    }
+}
+
+// Every worker reads the header, its block's slice of nodemap and that slice's neighbors from the binary graph, so no
+// rank ever holds more than its own block. The master only learns n and e.
+graph *loadPartitionedGraph(char *filename) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (size < 2) {
+        puts("partitioned graphs need at least one worker rank. exiting...");
+        exit(1);
+    }
+
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        printf("could not open %s. exiting...\n", filename);
+        exit(1);
+    }
+
+    csr_header header;
+    if (fread(&header, sizeof(csr_header), 1, f) != 1 || header.magic != CSR_MAGIC || header.version != CSR_VERSION) {
+        printf("partitioned graphs are read from binary graphs (version %d), convert %s with `convert`. exiting...\n",
+               CSR_VERSION, filename);
+        exit(1);
+    }
+
+    graph *g = malloc(sizeof(graph));
+    g->n = header.n;
+    g->e = header.e;
+    g->nodemap = NULL;
+    g->edgelist = NULL;
+    g->mapping = NULL;
+    g->mapping_size = 0;
+    g->cedges = NULL;
+    g->coffsets = NULL;
+    g->rows = calloc(g->n, sizeof(int *));
+    g->fetch = fetchRow;
+
+    partition *p = calloc(1, sizeof(partition));
+    g->part = p;
+
+    p->block = (g->n + size - 2) / (size - 1);
+    if (p->block == 0)
+        p->block = 1;
+
+    if (rank > 0) {
+        p->first = (long) (rank - 1) * p->block < g->n ? (rank - 1) * p->block : g->n;
+        p->last = g->n - p->first < p->block ? g->n : p->first + p->block;
+    }
+
+    int count = p->last - p->first;
+    int *nodemap = malloc(sizeof(int) * (count + 1));
+    readInts(f, filename, nodemap, p->first, count + 1);
+
+    int edges = nodemap[count] - nodemap[0];
+    if (edges < 0 || nodemap[0] < 0 || nodemap[count] > g->e) {
+        printf("%s is corrupt: rows %d to %d span edges %d to %d of %d. exiting...\n", filename, p->first, p->last,
+               nodemap[0], nodemap[count], g->e);
+        exit(1);
+    }
+
+    // rows are the degree followed by the neighbors, so read the neighbors behind room for the degrees and move them
+    // into place front to back
+    int total = count + edges;
+    p->local = malloc(sizeof(int) * (total > 0 ? total : 1));
+    readInts(f, filename, p->local + count, (long) g->n + 1 + nodemap[0], edges);
+    fclose(f);
+
+    p->offsets = malloc(sizeof(int) * (count + 1));
+    p->offsets[0] = 0;
+
+    int i;
+    for (i = 0; i < count; i++) {
+        int degree = nodemap[i + 1] - nodemap[i];
+        if (degree < 0) {
+            printf("%s is corrupt: node %d has negative degree. exiting...\n", filename, p->first + i);
+            exit(1);
+        }
+        p->offsets[i + 1] = p->offsets[i] + 1 + degree;
+
+        int *row = p->local + p->offsets[i];
+        memmove(row + 1, p->local + count + (nodemap[i] - nodemap[0]), sizeof(int) * degree);
+        row[0] = degree;
+        g->rows[p->first + i] = row;
+    }
+
+    free(nodemap);
+
+    MPI_Win_create(p->offsets, sizeof(int) * (MPI_Aint) (count + 1), sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &p->offsets_win);
+    MPI_Win_create(p->local, sizeof(int) * (MPI_Aint) total, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &p->rows_win);
+
+    // one passive target epoch for the whole run, owners never have to take part in a fetch
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, p->offsets_win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, p->rows_win);
+
+    return g;
+}
+
+// Fetch the rows of all given nodes that aren't here yet. All gets are issued before waiting for any of them,
+// so a whole batch costs two round trips rather than two per node
+void prefetchRows(graph *g, int *nodes, int count) {
+    partition *p = g->part;
+
+    int *missing = malloc(sizeof(int) * (count > 0 ? count : 1));
+    int m = 0;
+    int i;
+    for (i = 0; i < count; i++)
+        if (g->rows[nodes[i]] == NULL)
+            missing[m++] = nodes[i];
+
+    if (m == 0) {
+        free(missing);
+        return;
+    }
+
+    // dedupe
+    qsort(missing, m, sizeof(int), compareInts);
+    int unique = 1;
+    for (i = 1; i < m; i++)
+        if (missing[i] != missing[unique - 1])
+            missing[unique++] = missing[i];
+    m = unique;
+
+    // row bounds first, then the rows themselves
+    int *bounds = malloc(sizeof(int) * 2 * m);
+    for (i = 0; i < m; i++) {
+        int owner = nodeOwner(p, missing[i]);
+        MPI_Aint position = missing[i] - (owner - 1) * p->block;
+        MPI_Get(&bounds[2 * i], 2, MPI_INT, owner, position, 2, MPI_INT, p->offsets_win);
+    }
+    MPI_Win_flush_all(p->offsets_win);
+
+    for (i = 0; i < m; i++) {
+        int length = bounds[2 * i + 1] - bounds[2 * i];
+        int *row = malloc(sizeof(int) * length);
+        MPI_Get(row, length, MPI_INT, nodeOwner(p, missing[i]), bounds[2 * i], length, MPI_INT, p->rows_win);
+        g->rows[missing[i]] = row;
+
+        p->nfetched++;
+        p->fetched_ints += length;
+
+        if (p->ncached == p->cached_capacity) {
+            p->cached_capacity = p->cached_capacity > 0 ? 2 * p->cached_capacity : 1024;
+            p->cached = realloc(p->cached, sizeof(int) * p->cached_capacity);
+        }
+        p->cached[p->ncached++] = missing[i];
+        p->cached_ints += length;
+    }
+    MPI_Win_flush_all(p->rows_win);
+
+    free(bounds);
+    free(missing);
+}
+
+// fetch the rows of every node in a community that touches this rank's block, since those are what sampling here
+// will look at first
+void prefetchHalo(c_index *ind) {
+    partition *p = ind->g->part;
+
+    char *seen = calloc(ind->n, 1);
+    int capacity = 1024;
+    int *halo = malloc(sizeof(int) * capacity);
+    int count = 0;
+
+    int u, i, k;
+    for (u = p->first; u < p->last; u++) {
+        for (i = 0; i < ind->lengths[u]; i++) {
+            community *c = ind->communities[u][i];
+            for (k = 0; k < c->n; k++) {
+                int v = c->nodes[k];
+                if (seen[v] || (v >= p->first && v < p->last))
+                    continue;
+                seen[v] = 1;
+
+                if (count == capacity) {
+                    capacity *= 2;
+                    halo = realloc(halo, sizeof(int) * capacity);
+                }
+                halo[count++] = v;
+            }
+        }
+    }
+
+    prefetchRows(ind->g, halo, count);
+
+    free(halo);
+    free(seen);
+}
+
+void trimRowCache(graph *g) {
+    partition *p = g->part;
+    if (p->cached_ints <= FETCH_CACHE_INTS)
+        return;
+
+    int evicted = 0;
+    while (evicted < p->ncached && p->cached_ints > FETCH_CACHE_INTS / 2) {
+        int u = p->cached[evicted++];
+        p->cached_ints -= g->rows[u][0] + 1;
+        free(g->rows[u]);
+        g->rows[u] = NULL;
+    }
+
+    p->ncached -= evicted;
+    memmove(p->cached, p->cached + evicted, sizeof(int) * p->ncached);
+}
+
+// collective, must be called by all ranks before MPI_Finalize
+void freePartitionedGraph(graph *g) {
+    partition *p = g->part;
+
+    MPI_Win_unlock_all(p->offsets_win);
+    MPI_Win_unlock_all(p->rows_win);
+    MPI_Win_free(&p->offsets_win);
+    MPI_Win_free(&p->rows_win);
+
+    int u;
+    for (u = 0; u < g->n; u++)
+        if (u < p->first || u >= p->last)
+            free(g->rows[u]);
+
+    free(g->rows);
+    free(p->cached);
+    free(p->offsets);
+    free(p->local);
+    free(p);
+    free(g);
+}
@@ -0,0 +1,53 @@
+//
+// Distributed graph storage for graphs that don't fit on one host.
+//
+
+#ifndef MPICOMM_PARTITION_H
+#define MPICOMM_PARTITION_H
+
+#include <mpi.h>
+#include "graph.h"
+#include "index.h"
+
+// The worker ranks 1..size-1 each own the adjacency of one contiguous block of node ids, rank 0 stores nothing
+// since the master never looks at edges. Each worker only samples pairs at nodes it owns, prefetches the rows of
+// all nodes in communities touching its block (the halo), and fetches anything else that merged communities
+// reach into on first use with a one-sided MPI_Get from the owner. The graph must be a binary CSR file (see convert),
+// of which each worker only reads its own block.
+//
+// Fetched rows are cached until they add up to more than FETCH_CACHE_INTS ints, then trimRowCache evicts the oldest
+#ifndef FETCH_CACHE_INTS
+#define FETCH_CACHE_INTS (1 << 24)
+#endif
+
+typedef struct {
+    MPI_Win offsets_win;
+    MPI_Win rows_win;
+    int *offsets; // owned node first + i's row starts at local[offsets[i]], offsets[last - first] is the total
+    int *local;   // rows of owned nodes, each is the degree followed by the sorted neighbors
+    int first;    // first owned node
+    int last;     // one past the last owned node
+    int block;    // nodes per worker
+    int nfetched; // number of rows fetched from other ranks so far
+    long fetched_ints;
+    int *cached;  // nodes whose fetched rows are in g->rows, oldest first
+    int ncached;
+    int cached_capacity;
+    long cached_ints; // total length of the cached rows
+} partition;
+
+graph *loadPartitionedGraph(char *filename);
+
+int nodeOwner(partition *p, int u);
+
+void prefetchRows(graph *g, int *nodes, int count);
+
+void prefetchHalo(c_index *ind);
+
+// Evicts the oldest fetched rows until the cache is down to half of FETCH_CACHE_INTS, if it has grown past that.
+// Rows in use must not be evicted, so this is only called between pair checks
+void trimRowCache(graph *g);
+
+void freePartitionedGraph(graph *g);
+
+#endif //MPICOMM_PARTITION_H
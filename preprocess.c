@@ -0,0 +1,305 @@
+//
+// Native replacement for preprocess.py and postprocess.py's node remapping.
+//
+// Reads a .metis graph and a .nl community file and writes
+//   <out_prefix>.metis  the graph without isolated nodes, neighbor lists sorted
+//   <out_prefix>.nl     communities in the new node ids, sorted, without communities of min_community_size nodes or less
+//   <out_prefix>.map    line i holds the original (1-indexed) id of new node i, mpicomm uses it to write its results
+//
+// Both files are streamed in large blocks, and each block is split into chunks at line boundaries
+// which are processed in parallel (if built with OpenMP) and written back in order.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define BLOCK_SIZE (64 * 1024 * 1024)
+#define CHUNKS_PER_THREAD 4
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} buffer;
+
+typedef struct {
+    int *ids;
+    int n;
+    int capacity;
+} id_list;
+
+// settings shared by all line handlers
+typedef struct {
+    int *new_ids; // new_ids[i] is the new 0-indexed id of original 0-indexed node i, or -1 if it was removed
+    int n;        // number of nodes in the original graph
+    int min_community_size;
+} remap;
+
+// handles one line (without its newline), appending output to out
+typedef void (*line_handler)(char *line, char *end, buffer *out, id_list *scratch, remap *r);
+
+static void reserve(buffer *b, size_t extra) {
+    if (b->len + extra > b->capacity) {
+        b->capacity = (b->len + extra) * 2;
+        b->data = realloc(b->data, b->capacity);
+    }
+}
+
+static void appendInt(buffer *b, int x) {
+    char digits[12];
+    int n = 0;
+    do {
+        digits[n++] = '0' + x % 10;
+        x /= 10;
+    } while (x > 0);
+
+    reserve(b, n);
+    while (n > 0)
+        b->data[b->len++] = digits[--n];
+}
+
+static void appendChar(buffer *b, char c) {
+    reserve(b, 1);
+    b->data[b->len++] = c;
+}
+
+static void push(id_list *l, int id) {
+    if (l->n == l->capacity) {
+        l->capacity = l->capacity * 2 + 16;
+        l->ids = realloc(l->ids, sizeof(int) * l->capacity);
+    }
+    l->ids[l->n++] = id;
+}
+
+static int compareInts(const void *a, const void *b) {
+    int x = *(const int *) a;
+    int y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+// parse the line's 1-indexed ids, map them to new 0-indexed ids and sort them. removed nodes are dropped
+static void parseLine(char *line, char *end, id_list *ids, remap *r) {
+    ids->n = 0;
+    char *p = line;
+    while (p < end) {
+        if (*p >= '0' && *p <= '9') {
+            int x = 0;
+            while (p < end && *p >= '0' && *p <= '9')
+                x = x * 10 + (*p++ - '0');
+
+            x--;
+            if (x < 0 || x >= r->n) {
+                printf("node id %d is out of range. exiting...\n", x + 1);
+                exit(1);
+            }
+            if (r->new_ids[x] != -1)
+                push(ids, r->new_ids[x]);
+        } else {
+            p++;
+        }
+    }
+
+    qsort(ids->ids, ids->n, sizeof(int), compareInts);
+}
+
+static void writeIds(buffer *out, id_list *ids) {
+    int i;
+    for (i = 0; i < ids->n; i++) {
+        if (i > 0)
+            appendChar(out, ' ');
+        appendInt(out, ids->ids[i] + 1);
+    }
+    appendChar(out, '\n');
+}
+
+// isolated nodes have empty lines and are dropped entirely
+static void graphLine(char *line, char *end, buffer *out, id_list *scratch, remap *r) {
+    parseLine(line, end, scratch, r);
+    if (scratch->n > 0)
+        writeIds(out, scratch);
+}
+
+static void communityLine(char *line, char *end, buffer *out, id_list *scratch, remap *r) {
+    parseLine(line, end, scratch, r);
+    if (scratch->n > r->min_community_size)
+        writeIds(out, scratch);
+}
+
+// stream every line of in through handle and write the results to out in order
+static void processLines(FILE *in, FILE *out, line_handler handle, remap *r) {
+    int nthreads = 1;
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    int nchunks = nthreads * CHUNKS_PER_THREAD;
+
+    buffer *outputs = calloc(nchunks, sizeof(buffer));
+    id_list *scratch = calloc(nchunks, sizeof(id_list));
+    char **chunk_start = malloc(sizeof(char *) * (nchunks + 1));
+
+    char *block = malloc(BLOCK_SIZE + 1);
+    size_t carry = 0; // bytes of an unfinished line left over from the previous block
+
+    for (;;) {
+        size_t got = fread(block + carry, 1, BLOCK_SIZE - carry, in);
+        size_t len = carry + got;
+        if (len == 0)
+            break;
+
+        // only process complete lines, unless this is the end of the file
+        char *end = block + len;
+        if (got == 0 && block[len - 1] != '\n') {
+            block[len++] = '\n';
+            end = block + len;
+        }
+        while (end > block && end[-1] != '\n')
+            end--;
+        if (end == block) {
+            printf("line longer than %d bytes. exiting...\n", BLOCK_SIZE);
+            exit(1);
+        }
+
+        int i;
+        chunk_start[0] = block;
+        for (i = 1; i < nchunks; i++) {
+            char *guess = block + (end - block) / nchunks * i;
+            if (guess <= chunk_start[i - 1]) {
+                chunk_start[i] = chunk_start[i - 1];
+            } else {
+                char *nl = memchr(guess - 1, '\n', end - guess + 1);
+                chunk_start[i] = nl + 1;
+            }
+        }
+        chunk_start[nchunks] = end;
+
+#pragma omp parallel for schedule(dynamic, 1)
+        for (i = 0; i < nchunks; i++) {
+            outputs[i].len = 0;
+            char *line = chunk_start[i];
+            while (line < chunk_start[i + 1]) {
+                char *nl = memchr(line, '\n', chunk_start[i + 1] - line);
+                handle(line, nl, &outputs[i], &scratch[i], r);
+                line = nl + 1;
+            }
+        }
+
+        for (i = 0; i < nchunks; i++)
+            fwrite(outputs[i].data, 1, outputs[i].len, out);
+
+        carry = block + len - end;
+        memmove(block, end, carry);
+    }
+
+    int i;
+    for (i = 0; i < nchunks; i++) {
+        free(outputs[i].data);
+        free(scratch[i].ids);
+    }
+    free(outputs);
+    free(scratch);
+    free(chunk_start);
+    free(block);
+}
+
+// first pass over the graph: empty lines are isolated nodes, everything else gets the next free id.
+// leaves f positioned at the first node line
+static remap *findIsolatedNodes(FILE *f, int *n, long *e) {
+    if (fscanf(f, "%d %ld", n, e) != 2) {
+        puts("could not read metis header. exiting...");
+        exit(1);
+    }
+    while (fgetc(f) != '\n');
+    long body = ftell(f);
+
+    remap *r = malloc(sizeof(remap));
+    r->n = *n;
+    r->new_ids = malloc(sizeof(int) * *n);
+
+    char *block = malloc(BLOCK_SIZE);
+    int node = 0;
+    int next_id = 0;
+    int line_empty = 1;
+    size_t got;
+    while (node < *n && (got = fread(block, 1, BLOCK_SIZE, f)) > 0) {
+        size_t i;
+        for (i = 0; i < got && node < *n; i++) {
+            if (block[i] == '\n') {
+                r->new_ids[node++] = line_empty ? -1 : next_id++;
+                line_empty = 1;
+            } else if (block[i] != ' ' && block[i] != '\r') {
+                line_empty = 0;
+            }
+        }
+    }
+    if (node < *n) // no newline at EOF
+        r->new_ids[node++] = line_empty ? -1 : next_id++;
+
+    if (node != *n) {
+        printf("metis header says %d nodes, but found %d. exiting...\n", *n, node);
+        exit(1);
+    }
+
+    free(block);
+    fseek(f, body, SEEK_SET);
+
+    *n = next_id;
+    return r;
+}
+
+static FILE *openOrDie(char *prefix, char *suffix, char *mode) {
+    char name[strlen(prefix) + strlen(suffix) + 1];
+    strcpy(name, prefix);
+    strcat(name, suffix);
+
+    FILE *f = fopen(name, mode);
+    if (f == NULL) {
+        printf("could not open %s. exiting...\n", name);
+        exit(1);
+    }
+    return f;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 5) {
+        printf("usage: %s graph.metis communities.nl min_community_size out_prefix\n", argv[0]);
+        puts("writes out_prefix.metis, out_prefix.nl and out_prefix.map, pass all three to mpicomm");
+        return 1;
+    }
+
+    FILE *graph_in = openOrDie(argv[1], "", "r");
+    FILE *communities_in = openOrDie(argv[2], "", "r");
+    FILE *graph_out = openOrDie(argv[4], ".metis", "w");
+    FILE *communities_out = openOrDie(argv[4], ".nl", "w");
+    FILE *map_out = openOrDie(argv[4], ".map", "w");
+
+    int n;
+    long e;
+    remap *r = findIsolatedNodes(graph_in, &n, &e);
+    r->min_community_size = atoi(argv[3]);
+
+    fprintf(graph_out, "%d %ld\n", n, e);
+    processLines(graph_in, graph_out, graphLine, r);
+    processLines(communities_in, communities_out, communityLine, r);
+
+    int i;
+    for (i = 0; i < r->n; i++)
+        if (r->new_ids[i] != -1)
+            fprintf(map_out, "%d\n", i + 1);
+
+    printf("%d of %d nodes left after removing isolated nodes\n", n, r->n);
+
+    fclose(graph_in);
+    fclose(communities_in);
+    fclose(graph_out);
+    fclose(communities_out);
+    fclose(map_out);
+
+    free(r->new_ids);
+    free(r);
+
+    return 0;
+}
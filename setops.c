@@ -0,0 +1,510 @@
+//
+// Sorted int set kernels, see setops.h
+//
+// The SIMD versions all work the same way: compare a block of a against a block of b in all rotations,
+// OR together which lanes of a found a match, then advance whichever block has the smaller maximum
+// (or both if they're equal). Whatever is left over when a block no longer fits goes through the scalar code.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "setops.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SETOPS_X86
+#endif
+
+#define GALLOP_RATIO 128
+#define GALLOP_TINY 16
+
+typedef int (*intersect_fn)(const int *a, int na, const int *b, int nb);
+typedef int (*difference_fn)(const int *a, int na, const int *b, int nb, int *out);
+
+int gallop_ratio = GALLOP_RATIO;
+int gallop_tiny = GALLOP_TINY;
+
+static intersect_fn intersect_kernel = NULL;
+static difference_fn difference_kernel = NULL;
+static const char *kernel_name = NULL;
+
+/////////////
+// SCALAR  //
+/////////////
+
+static int intersectCountScalar(const int *a, int na, const int *b, int nb) {
+    int count = 0;
+    int j = 0; // index in a
+    int k = 0; // index in b
+
+    while (j < na && k < nb) {
+        int x = a[j];
+        int y = b[k];
+        count += x == y;
+        j += x <= y;
+        k += y <= x;
+    }
+
+    return count;
+}
+
+// a - b, except that a[t] for t < skip_until is dropped if bit t of skip is set (used for SIMD tails)
+static int differenceTail(const int *a, int na, const int *b, int nb, int *out, int skip, int skip_until) {
+    int k = 0; // index in b
+    int written = 0;
+    int t;
+    for (t = 0; t < na; t++) {
+        if (t < skip_until && (skip >> t) & 1)
+            continue;
+        while (k < nb && b[k] < a[t])
+            k++;
+        if (k == nb || b[k] != a[t])
+            out[written++] = a[t];
+    }
+    return written;
+}
+
+static int differenceScalar(const int *a, int na, const int *b, int nb, int *out) {
+    return differenceTail(a, na, b, nb, out, 0, 0);
+}
+
+/////////////
+// GALLOP  //
+/////////////
+
+// index of the first element of b[lo:nb] that is >= x
+static inline int gallop(const int *b, int lo, int nb, int x) {
+    if (lo >= nb || b[lo] >= x)
+        return lo;
+
+    // b[lo] < x. double the step until we overshoot, then binary search the last step
+    int step = 1;
+    int hi = lo + 1;
+    while (hi < nb && b[hi] < x) {
+        lo = hi;
+        step <<= 1;
+        hi = lo + step;
+    }
+    if (hi > nb)
+        hi = nb;
+
+    // b[lo] < x <= b[hi] (or hi == nb)
+    while (lo + 1 < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (b[mid] < x)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return hi;
+}
+
+static inline int shouldGallop(int small, int large) {
+    return (long) small * gallop_ratio < large || (small < gallop_tiny && 4L * small <= large);
+}
+
+// a is the smaller set
+static int intersectCountGallop(const int *a, int na, const int *b, int nb) {
+    int count = 0;
+    int j = 0;
+    int i;
+    for (i = 0; i < na; i++) {
+        j = gallop(b, j, nb, a[i]);
+        if (j == nb)
+            break;
+        if (b[j] == a[i]) {
+            count++;
+            j++;
+        }
+    }
+    return count;
+}
+
+// a - b for small a: keep each element of a that b doesn't have
+static int differenceGallopSmall(const int *a, int na, const int *b, int nb, int *out) {
+    int written = 0;
+    int j = 0;
+    int i;
+    for (i = 0; i < na; i++) {
+        j = gallop(b, j, nb, a[i]);
+        if (j == nb || b[j] != a[i])
+            out[written++] = a[i];
+    }
+    return written;
+}
+
+// a - b for small b: copy the runs of a between b's elements
+static int differenceGallopLarge(const int *a, int na, const int *b, int nb, int *out) {
+    int written = 0;
+    int i = 0;
+    int k;
+    for (k = 0; k < nb && i < na; k++) {
+        int p = gallop(a, i, na, b[k]);
+        memcpy(out + written, a + i, sizeof(int) * (p - i));
+        written += p - i;
+        i = p < na && a[p] == b[k] ? p + 1 : p;
+    }
+    memcpy(out + written, a + i, sizeof(int) * (na - i));
+    return written + na - i;
+}
+
+#ifdef SETOPS_X86
+
+/////////////
+//   SSE   //
+/////////////
+
+static __m128i sse_compress[16]; // pshufb masks moving the lanes set in the index to the front
+
+static void initSSE() {
+    int mask, lane, byte;
+    for (mask = 0; mask < 16; mask++) {
+        unsigned char shuffle[16];
+        int out = 0;
+        memset(shuffle, 0x80, 16);
+        for (lane = 0; lane < 4; lane++) {
+            if (!((mask >> lane) & 1))
+                continue;
+            for (byte = 0; byte < 4; byte++)
+                shuffle[out * 4 + byte] = lane * 4 + byte;
+            out++;
+        }
+        memcpy(&sse_compress[mask], shuffle, 16);
+    }
+}
+
+// bit i is set iff a's lane i equals any lane of vb
+__attribute__((target("sse4.2")))
+static inline int matchesSSE(__m128i va, __m128i vb) {
+    __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+    return _mm_movemask_ps(_mm_castsi128_ps(m));
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static int intersectCountSSE(const int *a, int na, const int *b, int nb) {
+    int i = 0, j = 0, count = 0;
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + j));
+        count += __builtin_popcount(matchesSSE(va, vb));
+
+        int amax = a[i + 3];
+        int bmax = b[j + 3];
+        i += (amax <= bmax) * 4;
+        j += (bmax <= amax) * 4;
+    }
+    return count + intersectCountScalar(a + i, na - i, b + j, nb - j);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static int differenceSSE(const int *a, int na, const int *b, int nb, int *out) {
+    int i = 0, j = 0, written = 0;
+    int found = 0; // lanes of the current block of a that are in b
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + j));
+        found |= matchesSSE(va, vb);
+
+        int amax = a[i + 3];
+        int bmax = b[j + 3];
+        if (amax <= bmax) { // this block of a is done, write the lanes that weren't found
+            int keep = ~found & 0xf;
+            _mm_storeu_si128((__m128i *) (out + written), _mm_shuffle_epi8(va, sse_compress[keep]));
+            written += __builtin_popcount(keep);
+            found = 0;
+            i += 4;
+        }
+        if (bmax <= amax)
+            j += 4;
+    }
+    return written + differenceTail(a + i, na - i, b + j, nb - j, out + written, found, 4);
+}
+
+/////////////
+//  AVX2   //
+/////////////
+
+static int avx2_compress[256][8]; // permutevar8x32 indices moving the lanes set in the index to the front
+
+static void initAVX2() {
+    int mask, lane;
+    for (mask = 0; mask < 256; mask++) {
+        int out = 0;
+        for (lane = 0; lane < 8; lane++)
+            if ((mask >> lane) & 1)
+                avx2_compress[mask][out++] = lane;
+        while (out < 8)
+            avx2_compress[mask][out++] = 0;
+    }
+}
+
+__attribute__((target("avx2")))
+static inline int matchesAVX2(__m256i va, __m256i vb) {
+    __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    __m256i m = _mm256_cmpeq_epi32(va, vb);
+    int r;
+    for (r = 1; r < 8; r++) {
+        vb = _mm256_permutevar8x32_epi32(vb, rotate);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi32(va, vb));
+    }
+    return _mm256_movemask_ps(_mm256_castsi256_ps(m));
+}
+
+__attribute__((target("avx2,popcnt")))
+static int intersectCountAVX2(const int *a, int na, const int *b, int nb) {
+    int i = 0, j = 0, count = 0;
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m256i va = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *) (b + j));
+        count += __builtin_popcount(matchesAVX2(va, vb));
+
+        int amax = a[i + 7];
+        int bmax = b[j + 7];
+        i += (amax <= bmax) * 8;
+        j += (bmax <= amax) * 8;
+    }
+    return count + intersectCountSSE(a + i, na - i, b + j, nb - j);
+}
+
+__attribute__((target("avx2,popcnt")))
+static int differenceAVX2(const int *a, int na, const int *b, int nb, int *out) {
+    int i = 0, j = 0, written = 0;
+    int found = 0;
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m256i va = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *) (b + j));
+        found |= matchesAVX2(va, vb);
+
+        int amax = a[i + 7];
+        int bmax = b[j + 7];
+        if (amax <= bmax) {
+            int keep = ~found & 0xff;
+            __m256i indices = _mm256_loadu_si256((const __m256i *) avx2_compress[keep]);
+            _mm256_storeu_si256((__m256i *) (out + written), _mm256_permutevar8x32_epi32(va, indices));
+            written += __builtin_popcount(keep);
+            found = 0;
+            i += 8;
+        }
+        if (bmax <= amax)
+            j += 8;
+    }
+    return written + differenceTail(a + i, na - i, b + j, nb - j, out + written, found, 8);
+}
+
+/////////////
+// AVX-512 //
+/////////////
+
+__attribute__((target("avx512f")))
+static inline int matchesAVX512(__m512i va, __m512i vb) {
+    __mmask16 m = _mm512_cmpeq_epi32_mask(va, vb);
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 1));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 2));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 3));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 4));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 5));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 6));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 7));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 8));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 9));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 10));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 11));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 12));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 13));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 14));
+    m |= _mm512_cmpeq_epi32_mask(va, _mm512_alignr_epi32(vb, vb, 15));
+    return m;
+}
+
+__attribute__((target("avx512f,avx2,popcnt")))
+static int intersectCountAVX512(const int *a, int na, const int *b, int nb) {
+    int i = 0, j = 0, count = 0;
+    while (i + 16 <= na && j + 16 <= nb) {
+        __m512i va = _mm512_loadu_si512((const void *) (a + i));
+        __m512i vb = _mm512_loadu_si512((const void *) (b + j));
+        count += __builtin_popcount(matchesAVX512(va, vb));
+
+        int amax = a[i + 15];
+        int bmax = b[j + 15];
+        i += (amax <= bmax) * 16;
+        j += (bmax <= amax) * 16;
+    }
+    return count + intersectCountAVX2(a + i, na - i, b + j, nb - j);
+}
+
+__attribute__((target("avx512f,popcnt")))
+static int differenceAVX512(const int *a, int na, const int *b, int nb, int *out) {
+    int i = 0, j = 0, written = 0;
+    int found = 0;
+    while (i + 16 <= na && j + 16 <= nb) {
+        __m512i va = _mm512_loadu_si512((const void *) (a + i));
+        __m512i vb = _mm512_loadu_si512((const void *) (b + j));
+        found |= matchesAVX512(va, vb);
+
+        int amax = a[i + 15];
+        int bmax = b[j + 15];
+        if (amax <= bmax) {
+            __mmask16 keep = ~found & 0xffff;
+            _mm512_mask_compressstoreu_epi32(out + written, keep, va);
+            written += __builtin_popcount(keep);
+            found = 0;
+            i += 16;
+        }
+        if (bmax <= amax)
+            j += 16;
+    }
+    return written + differenceTail(a + i, na - i, b + j, nb - j, out + written, found, 16);
+}
+
+#endif // SETOPS_X86
+
+//////////////
+// DISPATCH //
+//////////////
+
+static void chooseKernels() {
+    char *force = getenv("MPICOMM_SETOPS");
+    intersect_fn intersect = intersectCountScalar;
+    difference_fn diff = differenceScalar;
+    const char *name = "scalar";
+
+#ifdef SETOPS_X86
+    __builtin_cpu_init();
+    initSSE();
+    initAVX2();
+
+    int sse = __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+    int avx2 = sse && __builtin_cpu_supports("avx2");
+    int avx512 = avx2 && __builtin_cpu_supports("avx512f");
+
+    if (force != NULL) {
+        sse = sse && strcmp(force, "scalar") != 0;
+        avx2 = avx2 && (strcmp(force, "avx2") == 0 || strcmp(force, "avx512") == 0);
+        avx512 = avx512 && strcmp(force, "avx512") == 0;
+    }
+
+    if (avx512) {
+        intersect = intersectCountAVX512;
+        diff = differenceAVX512;
+        name = "avx512";
+    } else if (avx2) {
+        intersect = intersectCountAVX2;
+        diff = differenceAVX2;
+        name = "avx2";
+    } else if (sse) {
+        intersect = intersectCountSSE;
+        diff = differenceSSE;
+        name = "sse";
+    }
+#endif
+
+    difference_kernel = diff;
+    kernel_name = name;
+    intersect_kernel = intersect; // set last, it's what the other functions check
+}
+
+int intersectCount(const int *a, int na, const int *b, int nb) {
+    if (intersect_kernel == NULL)
+        chooseKernels();
+
+    if (shouldGallop(na, nb))
+        return intersectCountGallop(a, na, b, nb);
+    if (shouldGallop(nb, na))
+        return intersectCountGallop(b, nb, a, na);
+
+    return intersect_kernel(a, na, b, nb);
+}
+
+int difference(const int *a, int na, const int *b, int nb, int *out) {
+    if (intersect_kernel == NULL)
+        chooseKernels();
+
+    if (shouldGallop(na, nb))
+        return differenceGallopSmall(a, na, b, nb, out);
+    if (shouldGallop(nb, na))
+        return differenceGallopLarge(a, na, b, nb, out);
+
+    return difference_kernel(a, na, b, nb, out);
+}
+
+// a union b = a merged with (b - a). b - a goes to the back of out first, and since out[k] with k <= i + j is
+// written only after (b - a)[j] at out[na + j] has been read, merging into the front of out is safe
+int setUnionInto(const int *a, int na, const int *b, int nb, int *out) {
+    int *rest = out + na;
+    int nrest = difference(b, nb, a, na, rest);
+
+    int i = 0, j = 0, k = 0;
+    while (i < na && j < nrest) { // a and rest are disjoint, so there are no ties
+        int x = a[i];
+        int y = rest[j];
+        int take_a = x < y;
+        out[k++] = take_a ? x : y;
+        i += take_a;
+        j += !take_a;
+    }
+    while (i < na)
+        out[k++] = a[i++];
+    while (j < nrest)
+        out[k++] = rest[j++];
+
+    return k;
+}
+
+// writes all three outputs, so it's linear anyway. A negative cutoff never bails out, checkPair counts the overlap
+// with intersectCount first and only splits the pairs that pass
+int splitPair(const int *a, int na, const int *b, int nb, int cutoff,
+              int *only_a, int *n_only_a, int *only_b, int *n_only_b, int *merged) {
+    int i = 0, j = 0, k = 0;
+    int ka = 0, kb = 0;
+    int common = 0;
+
+    while (i < na && j < nb) {
+        int x = a[i];
+        int y = b[j];
+        if (x == y) {
+            merged[k++] = x;
+            common++;
+            i++;
+            j++;
+            continue;
+        }
+
+        if (x < y) {
+            only_a[ka++] = x;
+            merged[k++] = x;
+            i++;
+        } else {
+            only_b[kb++] = y;
+            merged[k++] = y;
+            j++;
+        }
+
+        // the overlap can at most grow by what's left of the shorter remainder
+        int left = na - i < nb - j ? na - i : nb - j;
+        if (ka > 0 && kb > 0 && common + left <= cutoff)
+            return -1;
+    }
+
+    while (i < na) {
+        only_a[ka++] = a[i];
+        merged[k++] = a[i++];
+    }
+    while (j < nb) {
+        only_b[kb++] = b[j];
+        merged[k++] = b[j++];
+    }
+
+    *n_only_a = ka;
+    *n_only_b = kb;
+    return common;
+}
+
+const char *setopsKernels() {
+    if (intersect_kernel == NULL)
+        chooseKernels();
+    return kernel_name;
+}
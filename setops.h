@@ -0,0 +1,37 @@
+//
+// Sorted int set kernels behind commonElements, setUnion and setMinus.
+//
+
+#ifndef MPICOMM_SETOPS_H
+#define MPICOMM_SETOPS_H
+
+// All inputs are sorted arrays of distinct ints. Outputs are sorted too.
+// The kernels are picked on first use from what the CPU supports (AVX-512, AVX2, SSE4.2, else scalar).
+// Set MPICOMM_SETOPS to scalar, sse, avx2 or avx512 to force a specific one.
+
+// |a intersect b|
+int intersectCount(const int *a, int na, const int *b, int nb);
+
+// writes a - b to out, which must have room for na ints. returns the number written
+int difference(const int *a, int na, const int *b, int nb, int *out);
+
+// writes a union b to out, which must have room for na + nb ints. returns the number written
+int setUnionInto(const int *a, int na, const int *b, int nb, int *out);
+
+// Splits a and b in a single pass into only_a = a - b, only_b = b - a and merged = a union b, which must have room
+// for na, nb and na + nb ints. Returns |a intersect b|, or -1 as soon as that can no longer exceed cutoff and neither
+// set can be contained in the other. The outputs are incomplete then
+int splitPair(const int *a, int na, const int *b, int nb, int cutoff,
+              int *only_a, int *n_only_a, int *only_b, int *n_only_b, int *merged);
+
+// name of the kernels in use
+const char *setopsKernels();
+
+// If one set is more than gallop_ratio times larger than the other, intersectCount and difference walk the smaller
+// set and find each element in the larger one by galloping (exponential then binary search), which costs
+// O(small * log(large / small)) instead of O(small + large). Sets of less than gallop_tiny elements don't fill a
+// SIMD block, so they already gallop once the other set is four times as large. bench_setops measures the crossover
+extern int gallop_ratio;
+extern int gallop_tiny;
+
+#endif //MPICOMM_SETOPS_H
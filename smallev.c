@@ -0,0 +1,166 @@
+//
+// Fixed-size eigen kernels for small communities, see smallev.h
+//
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include "smallev.h"
+
+// The helpers take the row stride of the matrix, which each kernel below fixes to its bucket size. Inlined into a
+// kernel, all row offsets are compile-time multiples and the row loops vectorize without alignment or aliasing checks.
+// Everything is in double whatever EV_DOUBLE says, it's all on the stack anyway
+
+// normalized Laplacian of c's induced subgraph into l, n x n with the given stride. Like laplacianInto, the edges are
+// scattered through the thread's lookup table with one 1 / sqrt per node, but into both triangles
+static inline void smallLaplacian(graph *g, community *c, double *l, int stride) {
+    int n = c->n;
+    double degrees[SMALL_EV_MAX_SIZE];
+    double inv_sqrt[SMALL_EV_MAX_SIZE];
+    int *local_index = localIndex(g, c);
+    int i, v;
+    neighbor_iter it;
+
+    for (i = 0; i < n; i++) {
+        int degree = 0;
+        neighbors(g, c->nodes[i], &it);
+        while (nextNeighbor(&it, &v))
+            degree += local_index[v] >= 0;
+        degrees[i] = degree;
+        inv_sqrt[i] = degree > 0 ? 1 / sqrt(degrees[i]) : 0;
+    }
+
+    // rows are stride apart, so clearing the first n rows in one go clears the n x n block
+    memset(l, 0, sizeof(double) * (size_t) n * stride);
+    for (i = 0; i < n; i++) {
+        double *row = l + i * stride;
+        double scale = inv_sqrt[i];
+        neighbors(g, c->nodes[i], &it);
+        while (nextNeighbor(&it, &v)) {
+            int j = local_index[v];
+            if (j >= 0)
+                row[j] = -scale * inv_sqrt[j];
+        }
+        row[i] = degrees[i] > 0 ? 1 : 0;
+    }
+
+    releaseLocalIndex(c);
+}
+
+// Reduces the symmetric n x n matrix a to tridiagonal form with diagonal d and off-diagonal e (e[i] couples i and
+// i + 1) by Householder reflections, overwriting a
+static inline void tridiagonalize(double *a, int n, int stride, double *d, double *e) {
+    double v[SMALL_EV_MAX_SIZE];
+    double p[SMALL_EV_MAX_SIZE];
+    int i, j, k;
+
+    for (k = 0; k + 2 < n; k++) {
+        // reflect column k below the diagonal onto its first entry
+        double norm = 0;
+        for (i = k + 1; i < n; i++)
+            norm += a[i * stride + k] * a[i * stride + k];
+        norm = sqrt(norm);
+
+        double x0 = a[(k + 1) * stride + k];
+        double alpha = x0 > 0 ? -norm : norm;
+        e[k] = alpha;
+        if (norm == 0)
+            continue;
+
+        double vv = 0;
+        for (i = k + 1; i < n; i++) {
+            v[i] = a[i * stride + k];
+            if (i == k + 1)
+                v[i] -= alpha;
+            vv += v[i] * v[i];
+        }
+        if (vv == 0) // column already in tridiagonal form
+            continue;
+        double beta = 2 / vv;
+
+        // trailing block S -= v q^T + q v^T with p = beta S v, q = p - (beta / 2) (v . p) v
+        double vp = 0;
+        for (i = k + 1; i < n; i++) {
+            const double *row = a + i * stride;
+            double sum = 0;
+            for (j = k + 1; j < n; j++)
+                sum += row[j] * v[j];
+            p[i] = beta * sum;
+            vp += v[i] * p[i];
+        }
+        double half = beta * vp / 2;
+        for (i = k + 1; i < n; i++)
+            p[i] -= half * v[i];
+
+        for (i = k + 1; i < n; i++) {
+            double *row = a + i * stride;
+            for (j = k + 1; j < n; j++)
+                row[j] -= v[i] * p[j] + p[i] * v[j];
+        }
+    }
+
+    for (i = 0; i < n; i++)
+        d[i] = a[i * stride + i];
+    if (n >= 2)
+        e[n - 2] = a[(n - 1) * stride + n - 2];
+}
+
+// number of eigenvalues of the tridiagonal matrix (d, e) below x, from the signs of its Sturm sequence
+static int eigenvaluesBelow(const double *d, const double *e, int n, double x) {
+    int count = 0;
+    double q = d[0] - x;
+    int i;
+    for (i = 0;; i++) {
+        if (q == 0)
+            q = -DBL_EPSILON;
+        if (q < 0)
+            count++;
+        if (i + 1 == n)
+            return count;
+        q = d[i + 1] - x - e[i] * e[i] / q;
+    }
+}
+
+// lambda 2 of the tridiagonal matrix (d, e) by bisection. Normalized Laplacians have their eigenvalues in [0, 2]
+static double secondEigenvalue(const double *d, const double *e, int n, double abstol) {
+    double tol = abstol > 4 * DBL_EPSILON ? abstol : 4 * DBL_EPSILON;
+    double lo = -tol;
+    double hi = 2 + tol;
+    while (hi - lo > tol) {
+        double mid = (lo + hi) / 2;
+        if (mid <= lo || mid >= hi)
+            break;
+        if (eigenvaluesBelow(d, e, n, mid) >= 2)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    return (lo + hi) / 2;
+}
+
+#define SMALL_EV_KERNEL(N)                                       \
+    static float smallEv##N(graph *g, community *c, double abstol) { \
+        double l[N * N];                                         \
+        double d[N];                                             \
+        double e[N];                                             \
+        smallLaplacian(g, c, l, N);                              \
+        tridiagonalize(l, c->n, N, d, e);                        \
+        return secondEigenvalue(d, e, c->n, abstol);             \
+    }
+
+SMALL_EV_KERNEL(8)
+SMALL_EV_KERNEL(16)
+SMALL_EV_KERNEL(32)
+SMALL_EV_KERNEL(64)
+
+float smallCommunityEv(graph *g, community *c, double abstol) {
+    if (c->n < 2)
+        return 0;
+    if (c->n <= 8)
+        return smallEv8(g, c, abstol);
+    if (c->n <= 16)
+        return smallEv16(g, c, abstol);
+    if (c->n <= 32)
+        return smallEv32(g, c, abstol);
+    return smallEv64(g, c, abstol);
+}
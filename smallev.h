@@ -0,0 +1,24 @@
+//
+// Fixed-size eigen kernels for lambda 2 of small communities.
+//
+
+#ifndef MPICOMM_SMALLEV_H
+#define MPICOMM_SMALLEV_H
+
+#include "graph.h"
+
+// communityEv uses these kernels for communities of up to SMALL_EV_MAX_SIZE nodes instead of going through the
+// workspace matrices and LAPACK, whose fixed overhead dominates at these sizes
+#ifndef SMALL_EV
+#define SMALL_EV 1
+#endif
+
+#define SMALL_EV_MAX_SIZE 64
+
+// Lambda 2 of c's normalized Laplacian to within abstol, 0 for full precision. c must have at most SMALL_EV_MAX_SIZE
+// nodes. Dispatches to the kernel of the smallest of the 8, 16, 32 and 64 node buckets that fits c. Each builds the
+// Laplacian straight from the graph into a matrix of its size on the stack, reduces it to tridiagonal form with
+// Householder reflections and bisects for lambda 2 with Sturm counts
+float smallCommunityEv(graph *g, community *c, double abstol);
+
+#endif //MPICOMM_SMALLEV_H
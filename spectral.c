@@ -0,0 +1,342 @@
+//
+// Sparse Fiedler value computation, see spectral.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <lapacke.h>
+#include "spectral.h"
+
+// first index in nodes[lo:n] holding a value >= v
+static int lowerBound(const int *nodes, int lo, int n, int v) {
+    int hi = n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (nodes[mid] < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+sparse_laplacian *sparseLaplacian(graph *g, community *c) {
+    sparse_laplacian *l = malloc(sizeof(sparse_laplacian));
+    l->n = c->n;
+    l->offsets = malloc((c->n + 1) * sizeof(int));
+    l->sqrt_deg = malloc((c->n > 0 ? c->n : 1) * sizeof(double));
+
+    int capacity = c->n * 8 + 16;
+    l->cols = malloc(capacity * sizeof(int));
+
+    // neighbors come sorted, so each one is searched for only behind the previous hit
+    int i;
+    int nnz = 0;
+    l->offsets[0] = 0;
+    for (i = 0; i < c->n; i++) {
+        int v;
+        int k = 0;
+        neighbor_iter it;
+        neighbors(g, c->nodes[i], &it);
+        while (k < c->n && nextNeighbor(&it, &v)) {
+            k = lowerBound(c->nodes, k, c->n, v);
+            if (k == c->n || c->nodes[k] != v)
+                continue;
+
+            if (nnz == capacity) {
+                capacity *= 2;
+                l->cols = realloc(l->cols, capacity * sizeof(int));
+            }
+            l->cols[nnz++] = k++;
+        }
+        l->offsets[i + 1] = nnz;
+        l->sqrt_deg[i] = sqrt(nnz - l->offsets[i]);
+    }
+
+    l->vals = malloc((nnz > 0 ? nnz : 1) * sizeof(double));
+    for (i = 0; i < c->n; i++) {
+        int k;
+        for (k = l->offsets[i]; k < l->offsets[i + 1]; k++)
+            l->vals[k] = -1.0 / (l->sqrt_deg[i] * l->sqrt_deg[l->cols[k]]);
+    }
+
+    return l;
+}
+
+void freeSparseLaplacian(sparse_laplacian *l) {
+    free(l->offsets);
+    free(l->cols);
+    free(l->vals);
+    free(l->sqrt_deg);
+    free(l);
+}
+
+void laplacianMultiply(sparse_laplacian *l, const double *x, double *y) {
+    int i;
+    for (i = 0; i < l->n; i++) {
+        double sum = l->offsets[i + 1] > l->offsets[i] ? x[i] : 0;
+        int k;
+        for (k = l->offsets[i]; k < l->offsets[i + 1]; k++)
+            sum += l->vals[k] * x[l->cols[k]];
+        y[i] = sum;
+    }
+}
+
+static double dot(const double *x, const double *y, int n) {
+    double sum = 0;
+    int i;
+    for (i = 0; i < n; i++)
+        sum += x[i] * y[i];
+    return sum;
+}
+
+// x -= (x . q) q for unit q
+static void orthogonalize(double *x, const double *q, int n) {
+    double p = dot(x, q, n);
+    int i;
+    for (i = 0; i < n; i++)
+        x[i] -= p * q[i];
+}
+
+static double normalize(double *x, int n) {
+    double norm = sqrt(dot(x, x, n));
+    int i;
+    if (norm > 0)
+        for (i = 0; i < n; i++)
+            x[i] /= norm;
+    return norm;
+}
+
+// Smallest eigenvalue of the k x k tridiagonal matrix with diagonal alpha and off-diagonal beta, and its eigenvector
+// in y. Returns nonzero if LAPACK failed
+static int smallestRitzPair(const double *alpha, const double *beta, int k, double *theta, double *y,
+                            double *d, double *e, double *z) {
+    memcpy(d, alpha, k * sizeof(double));
+    memcpy(e, beta, k * sizeof(double));
+
+    // eigenvalues come out ascending, eigenvectors as the columns of z
+    lapack_int info = LAPACKE_dstev(LAPACK_COL_MAJOR, 'V', k, d, e, z, k);
+    if (info != 0) {
+        printf("ERROR FINDING EVS: info=%d\n", info);
+        return info;
+    }
+
+    *theta = d[0];
+    memcpy(y, z, k * sizeof(double));
+    return 0;
+}
+
+// Lanczos with full reorthogonalization on the complement of the trivial eigenvector. Whenever LANCZOS_MAX_ITER
+// vectors are used up without converging, it restarts from the current Ritz vector, so memory stays at
+// LANCZOS_MAX_ITER vectors no matter how many iterations the community needs
+float lanczosEv(sparse_laplacian *l, const double *start, double *fiedler, double tol) {
+    int n = l->n;
+    if (n < 2)
+        return 0;
+
+    double *trivial = malloc(n * sizeof(double));
+    memcpy(trivial, l->sqrt_deg, n * sizeof(double));
+    if (normalize(trivial, n) == 0) { // no edges at all, every eigenvalue is 0
+        free(trivial);
+        return 0;
+    }
+
+    int m = n - 1 < LANCZOS_MAX_ITER ? n - 1 : LANCZOS_MAX_ITER;
+    double *q = malloc((size_t) n * (m + 1) * sizeof(double)); // Lanczos vectors, q + j * n is the j-th
+    double *w = malloc(n * sizeof(double));
+    double *alpha = malloc(m * sizeof(double));
+    double *beta = malloc(m * sizeof(double));
+    double *y = malloc(m * sizeof(double));
+    double *d = malloc(m * sizeof(double));
+    double *e = malloc(m * sizeof(double));
+    double *z = malloc((size_t) m * m * sizeof(double));
+
+    // deterministic pseudo random start, so results don't depend on the rank. A given start gets a little of it
+    // mixed in, in case it misses the Fiedler vector entirely
+    int i, j;
+    unsigned int seed = 12345;
+    for (i = 0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        q[i] = (double) (seed >> 16) / 65536.0 - 0.5;
+    }
+    if (start != NULL) {
+        double scale = sqrt(dot(start, start, n) / dot(q, q, n)) * 1e-2;
+        for (i = 0; i < n; i++)
+            q[i] = start[i] + scale * q[i];
+    }
+
+    double theta = 0;
+    int converged = 0;
+    int restart;
+    for (restart = 0; restart <= LANCZOS_MAX_RESTARTS; restart++) {
+        orthogonalize(q, trivial, n);
+        if (normalize(q, n) == 0)
+            break;
+
+        int k = 0;
+        for (j = 0; j < m && !converged; j++) {
+            double *qj = q + (size_t) j * n;
+            laplacianMultiply(l, qj, w);
+            alpha[j] = dot(qj, w, n);
+
+            // full reorthogonalization, which also takes care of the three term recurrence. One pass of Gram-Schmidt
+            // leaves enough of the trivial eigenvector in w to eventually converge to a mix of it and the Fiedler
+            // vector, two are enough
+            int pass;
+            for (pass = 0; pass < 2; pass++) {
+                orthogonalize(w, trivial, n);
+                for (i = 0; i <= j; i++)
+                    orthogonalize(w, q + (size_t) i * n, n);
+            }
+            beta[j] = normalize(w, n);
+            k = j + 1;
+
+            // an exhausted Krylov space means theta is exact
+            int exhausted = beta[j] < 1e-12 || k == n - 1;
+            // warm starts converge within a few iterations, so check every one of those
+            if (k < 10 || k % 5 == 0 || k == m || exhausted) {
+                if (smallestRitzPair(alpha, beta, k, &theta, y, d, e, z) != 0) {
+                    converged = 1;
+                    break;
+                }
+                converged = exhausted || fabs(beta[j] * y[k - 1]) < tol;
+            }
+
+            memcpy(q + (size_t) (j + 1) * n, w, n * sizeof(double));
+        }
+
+        // the Ritz vector sum_j y_j q_j is the eigenvector, or where to restart from
+        for (i = 0; i < n; i++) {
+            double sum = 0;
+            for (j = 0; j < k; j++)
+                sum += y[j] * q[(size_t) j * n + i];
+            w[i] = sum;
+        }
+        memcpy(q, w, n * sizeof(double));
+
+        if (converged)
+            break;
+    }
+
+    if (fiedler != NULL)
+        memcpy(fiedler, q, n * sizeof(double));
+
+    free(trivial);
+    free(q);
+    free(w);
+    free(alpha);
+    free(beta);
+    free(y);
+    free(d);
+    free(e);
+    free(z);
+
+    return theta;
+}
+
+float evUpperBound(community *c) {
+    return c->n > 1 ? (float) c->n / (c->n - 1) : 0;
+}
+
+float mergedEvUpperBound(community *merged, pair_edges *edges) {
+    if (merged->n > 1 && edges->isolated > 0) // a second eigenvector with eigenvalue 0 lives on the isolated node
+        return 0;
+
+    float bound = evUpperBound(merged);
+    if (edges->a_volume == 0 || edges->c_volume == 0)
+        return bound;
+
+    // sum over edges (x_u - x_v)^2 divided by sum over nodes d_u x_u^2
+    double ia = 1.0 / edges->a_volume;
+    double ic = 1.0 / edges->c_volume;
+    double quotient = (edges->disjoint * (ia + ic) * (ia + ic) + edges->a_overlap * ia * ia + edges->c_overlap * ic * ic)
+                      / (ia + ic);
+
+    return quotient < bound ? quotient : bound;
+}
+
+// Adds parent's Fiedler vector, as eigenvector of l, to guess at the nodes c shares with parent and counts them in
+// contributions
+static void addParentGuess(sparse_laplacian *l, community *c, community *parent, double sign,
+                           double *guess, unsigned char *contributions) {
+    int i = 0, k = 0;
+    while (i < c->n && k < parent->n) {
+        if (c->nodes[i] < parent->nodes[k]) {
+            i++;
+        } else if (parent->nodes[k] < c->nodes[i]) {
+            k++;
+        } else {
+            guess[i] += sign * parent->fiedler[k] * l->sqrt_deg[i];
+            contributions[i]++;
+            i++;
+            k++;
+        }
+    }
+}
+
+// Fiedler vectors have an arbitrary sign, so b's is flipped if it disagrees with a's where they overlap
+static double relativeSign(community *a, community *b) {
+    double agreement = 0;
+    int i = 0, k = 0;
+    while (i < a->n && k < b->n) {
+        if (a->nodes[i] < b->nodes[k]) {
+            i++;
+        } else if (b->nodes[k] < a->nodes[i]) {
+            k++;
+        } else {
+            agreement += a->fiedler[i] * b->fiedler[k];
+            i++;
+            k++;
+        }
+    }
+    return agreement < 0 ? -1 : 1;
+}
+
+// Starting guess for c from the Fiedler vectors of a and b, NULL if neither has one. Node potentials carry over to the
+// merged community, the degrees are c's own. Nodes in both parents get the average
+static double *warmStart(sparse_laplacian *l, community *c, community *a, community *b) {
+    int has_a = a != NULL && a->fiedler != NULL;
+    int has_b = b != NULL && b->fiedler != NULL;
+    if (!has_a && !has_b)
+        return NULL;
+
+    double *guess = calloc(c->n, sizeof(double));
+    unsigned char *contributions = calloc(c->n, 1);
+
+    if (has_a)
+        addParentGuess(l, c, a, 1, guess, contributions);
+    if (has_b)
+        addParentGuess(l, c, b, has_a ? relativeSign(a, b) : 1, guess, contributions);
+
+    int i;
+    for (i = 0; i < c->n; i++)
+        if (contributions[i] > 1)
+            guess[i] /= contributions[i];
+
+    free(contributions);
+    return guess;
+}
+
+float sparseCommunityEv(graph *g, community *c, community *a, community *b, double abstol) {
+    sparse_laplacian *l = sparseLaplacian(g, c);
+    double *start = WARM_START_FIEDLER ? warmStart(l, c, a, b) : NULL;
+    double *fiedler = WARM_START_FIEDLER ? malloc(c->n * sizeof(double)) : NULL;
+
+    float ev = lanczosEv(l, start, fiedler, abstol > LANCZOS_TOL ? abstol : LANCZOS_TOL);
+
+    // store the node potentials D^-1/2 y, which don't depend on the degrees within c
+    if (fiedler != NULL) {
+        int i;
+        free(c->fiedler);
+        c->fiedler = malloc(c->n * sizeof(float));
+        for (i = 0; i < c->n; i++)
+            c->fiedler[i] = l->sqrt_deg[i] > 0 ? fiedler[i] / l->sqrt_deg[i] : 0;
+    }
+
+    free(start);
+    free(fiedler);
+    freeSparseLaplacian(l);
+    return ev;
+}
@@ -0,0 +1,63 @@
+//
+// Sparse normalized Laplacian and Lanczos solver for the Fiedler value (lambda 2) of large communities.
+//
+
+#ifndef MPICOMM_SPECTRAL_H
+#define MPICOMM_SPECTRAL_H
+
+#include "graph.h"
+
+// communityEv uses the sparse path for communities with at least this many nodes, and the dense LAPACK one below
+#define SPARSE_EV_MIN_SIZE 256
+
+// Lanczos vectors kept before restarting from the current Ritz vector, and the maximum number of restarts
+#define LANCZOS_MAX_ITER 120
+#define LANCZOS_MAX_RESTARTS 20
+// stop once the Ritz residual |L y - theta y| drops below this, which bounds the error of theta. At full precision that
+// is, else at ev_tolerance if that is larger
+#define LANCZOS_TOL 1e-5
+
+// Keep the Fiedler vector of every community whose lambda 2 came from Lanczos, and start Lanczos for a merged
+// community from its parents' vectors instead of a random vector. Parts of a community that are only loosely
+// connected to the rest are what the Fiedler vector separates, and merging mostly just adds such a part, so the
+// parents' vectors are already close and Lanczos converges in a few iterations. Costs one float per node of
+// every community of at least SPARSE_EV_MIN_SIZE nodes
+#ifndef WARM_START_FIEDLER
+#define WARM_START_FIEDLER 1
+#endif
+
+// Normalized Laplacian L = I - D^-1/2 A D^-1/2 of a community's induced subgraph in CSR form. The diagonal is
+// implicit: 1 for nodes with neighbors inside the community, 0 for isolated ones
+typedef struct {
+    int n;
+    int *offsets;     // row i's entries are cols/vals[offsets[i] : offsets[i + 1]]
+    int *cols;        // local indices into the community's nodes
+    double *vals;     // -1 / sqrt(d_i d_j)
+    double *sqrt_deg; // sqrt(d_i), the trivial eigenvector with eigenvalue 0 up to scaling
+} sparse_laplacian;
+
+sparse_laplacian *sparseLaplacian(graph *g, community *c);
+
+void freeSparseLaplacian(sparse_laplacian *l);
+
+// y = L x
+void laplacianMultiply(sparse_laplacian *l, const double *x, double *y);
+
+// Lambda 2 of L. Lanczos runs orthogonal to sqrt_deg, so the smallest eigenvalue it finds is the second smallest of L.
+// Starts from start if given, and writes the eigenvector to fiedler if given. Stops once the residual is below tol
+float lanczosEv(sparse_laplacian *l, const double *start, double *fiedler, double tol);
+
+// Cheap bounds on lambda 2, to decide some merges without solving anything. Without isolated nodes the trace of L is
+// n, and with them lambda 2 is 0, so n / (n - 1) bounds lambda 2 from above for any community
+float evUpperBound(community *c);
+
+// Rayleigh quotient of the test vector that is 1 / vol(a) on a, -1 / vol(c) on c and 0 on the overlap, which is
+// orthogonal to the trivial eigenvector and so bounds lambda 2 of merged from above. Exactly 0 if a or c has an isolated
+// node
+float mergedEvUpperBound(community *merged, pair_edges *edges);
+
+// Lambda 2 of c to within abstol, 0 for full precision. If parents are given, their Fiedler vectors make the starting
+// guess. Sets c->fiedler if WARM_START_FIEDLER
+float sparseCommunityEv(graph *g, community *c, community *a, community *b, double abstol);
+
+#endif //MPICOMM_SPECTRAL_H